@@ -11,6 +11,8 @@
 #include <string>
 #include <memory>
 #include <stdexcept>
+#include <array>
+#include <iterator>
 
 #include <GL/glew.h>
 
@@ -20,6 +22,7 @@
 
 #   include <GL/glut.h>
 #include <list>
+#include <map>
 #include <fstream>
 
 #endif
@@ -34,10 +37,25 @@
 
 #include "asstcommon.h"
 #include "scenegraph.h"
+#include "skeleton.h"
+#include "skinning.h"
+#include "scenefile.h"
 #include "drawer.h"
 #include "picker.h"
 #include "sgutils.h"
+#include "nodepool.h"
 #include "mesh.h"
+#include "subdivision.h"
+#include "stencilgeometry.h"
+#include "meshworker.h"
+#include "deformer.h"
+#include "packedgeometry.h"
+#include "vertexcache.h"
+#include "workerpool.h"
+#include "transformstore.h"
+#include "flatscene.h"
+#include "occlusion.h"
+#include "lights.h"
 
 
 // G L O B A L S ///////////////////////////////////////////////////
@@ -45,12 +63,12 @@
 // --------- IMPORTANT --------------------------------------------------------
 // Before you start working on this assignment, set the following variable
 // properly to indicate whether you want to use OpenGL 2.x with GLSL 1.0 or
-// OpenGL 3.x+ with GLSL 1.3.
+// OpenGL 3.1+ with GLSL 1.4.
 //
 // Set g_Gl2Compatible = true to use GLSL 1.0 and g_Gl2Compatible = false to
-// use GLSL 1.3. Make sure that your machine supports the version of GLSL you
+// use GLSL 1.4. Make sure that your machine supports the version of GLSL you
 // are using. In particular, on Mac OS X currently there is no way of using
-// OpenGL 3.x with GLSL 1.3 when GLUT is used.
+// OpenGL 3.x with GLSL 1.4 when GLUT is used.
 //
 // If g_Gl2Compatible=true, shaders with -gl2 suffix will be loaded.
 // If g_Gl2Compatible=false, shaders with -gl3 suffix will be loaded.
@@ -81,7 +99,9 @@ static std::shared_ptr<Material> g_redDiffuseMat,
         g_arcballMat,
         g_pickingMat,
         g_lightMat,
-        g_cubeMat;
+        g_cubeMat,
+        g_cubeStencilMat,
+        g_pickingStencilMat;
 
 std::shared_ptr<Material> g_overridingMaterial;
 
@@ -106,74 +126,24 @@ namespace asd {
         return std::apply(transform_parameters_to_tuple, container);
     }
 
-    void set_averaged_normals(Mesh& mesh) {
-        auto v_num = mesh.getNumVertices();
-
-        for (int i = 0; i < v_num; i++) {
-            mesh.getVertex(i).setNormal(Cvec3{0, 0, 0});
-        }
-
-        auto face_num = mesh.getNumFaces();
-        auto vector_adjacent_faces_cnt = std::vector(v_num, 0);
-        for (int fi = 0; fi < face_num; fi++) {
-            const auto& face = mesh.getFace(fi);
-            const auto& face_normal = face.getNormal();
-            for (int vi = 0; vi < face.getNumVertices(); vi++) {
-                auto&& v = face.getVertex(vi);
-                v.setNormal(v.getNormal() + face_normal);
-                vector_adjacent_faces_cnt.at(v.getIndex())++;
-            }
-        }
-
-        for (int i = 0; i < v_num; i++) {
-            auto&& v = mesh.getVertex(i);
-            v.setNormal(v.getNormal() / vector_adjacent_faces_cnt.at(i));
-        }
-    }
+    static double cube_animation_speed = 50;
 
-    SimpleGeometryPN transform_to_simpleGeometryPN(Mesh& mesh, bool do_smooth_shading) {
-        auto mesh_vertex_to_vertexPN = [](Mesh::Vertex from, Cvec3 normal) -> VertexPN {
-            auto ret = VertexPN{};
-            auto cvec3_to_cvec3f = [](Cvec3 cvec3) -> Cvec3f {
-                auto ret = Cvec3f{};
-                for (int i = 0; i < 3; i++) {
-                    ret[i] = static_cast<float>(cvec3[i]);
-                }
-                return ret;
-            };
-            ret.p = cvec3_to_cvec3f(from.getPosition());
-            ret.n = cvec3_to_cvec3f(normal);
+    // Deformation of the animated cube's control cage. It is applied to the cage before
+    // refinement, both for the GPU stencils and for the CPU worker, and is shared by them
+    static const DeformerStack& cube_deformers() {
+        static const auto stack = [] {
+            auto ret = DeformerStack{};
+            ret.push(std::make_shared<PulseDeformer>(0.0001));
             return ret;
-        };
-
-        auto geometry_vertices = std::vector<VertexPN>{};
-        for (int face_ind = 0; face_ind < mesh.getNumFaces(); face_ind++) {
-            const auto& face = mesh.getFace(face_ind);
-            const auto push_mesh_vertex = [&](int vertex_ind) {
-                auto&& v = face.getVertex(vertex_ind);
-                geometry_vertices.push_back(
-                        mesh_vertex_to_vertexPN(v, do_smooth_shading ? v.getNormal() : face.getNormal()));
-            };
-            for (int second_v_ind = 1; second_v_ind < face.getNumVertices() - 1; second_v_ind++) {
-                const auto& v = face.getVertex(second_v_ind);
-                push_mesh_vertex(0);
-                push_mesh_vertex(second_v_ind);
-                push_mesh_vertex(second_v_ind + 1);
-            }
-        }
-        assert(geometry_vertices.size() % 3 == 0);
-
-        auto ret = SimpleGeometryPN{};
-        ret.upload(&geometry_vertices[0], static_cast<int>(geometry_vertices.size()));
-
-        return ret;
+        }();
+        return stack;
     }
 
-    static double cube_animation_speed = 50;
+    static void wobble_cube(Mesh& mesh, int step) {
+        cube_deformers().apply(mesh, step);
+    }
 
     static void animate_cube_timer_callback(int step);
-
-    static void subdivide(Mesh& mesh);
 }
 
 static asd::animation animation;
@@ -268,10 +238,77 @@ using MyShapeNode = SgGeometryShapeNode;
 
 static bool waiting_pick = false;
 static std::shared_ptr<SgRootNode> g_world;
+// Rbts of all the SgRbtNodes of g_world. Animation and input write them here, and
+// drawStuff() applies the latest published frame to the scene graph
+static std::unique_ptr<TransformStore> g_transforms;
+// The SgRbtNodes of g_world in channel order, the order of the slots of
+// g_transforms and of the rbts of the keyframes
+static std::unique_ptr<RbtChannelBinding> g_channels;
+
+// g_transforms, first rebuilt if an edit of the hierarchy changed the channels,
+// in which case the keyframes follow their nodes to the new channels. The old
+// channels are matched through their pool handles: the node of a channel may
+// have died, and a new node taken over its address.
+static TransformStore& transforms() {
+    std::vector<PoolHandle<SgRbtNode>> previous;
+    if (g_channels->refresh(previous)) {
+        g_transforms->apply();
+        std::map<const SgRbtNode*, std::size_t> previous_channels;
+        for (std::size_t i = 0; i < previous.size(); i++) {
+            if (const auto* node = getNodePool<SgRbtNode>().get(previous[i]))
+                previous_channels[node] = i;
+        }
+
+        const auto& nodes = g_channels->getNodes();
+        for (auto& frame: animation) {
+            auto rbt_states = std::vector<RigTForm>(nodes.size());
+            for (std::size_t i = 0; i < nodes.size(); i++) {
+                const auto found = previous_channels.find(nodes[i]);
+                rbt_states[i] = found != previous_channels.end() && found->second < frame.rbt_states.size()
+                                ? frame.rbt_states[found->second] : nodes[i]->getRbt();
+            }
+            frame.rbt_states.swap(rbt_states);
+        }
+        g_transforms.reset(new TransformStore(nodes));
+    }
+    return *g_transforms;
+}
+
+static std::unique_ptr<WorkerPool> g_frame_workers;   // prepares frames of g_flat_world
+// g_world compiled into flat arrays, used to draw it
+static std::unique_ptr<FlatScene> g_flat_world;
+// Occluders of g_world, rasterized on the CPU to skip the shapes they hide; one
+// buffer per camera
+static std::vector<OcclusionBuffer> g_occlusion;
+static bool g_occlusion_culling = true;
+// Whether the cameras not looked through are shown too, in insets
+static bool g_split_screen = false;
 static std::shared_ptr<SgRbtNode> g_skyNode, g_groundNode, g_robot1Node, g_robot2Node, g_cubeNode;
+// A stone pillar standing in front of the second light, which it hides from the sky camera
+static std::shared_ptr<SgRbtNode> g_pillarNode;
+static const Cvec3 g_pillarSize(2.4, 4.4, 0.6);
 static std::shared_ptr<MyShapeNode> g_cubeShapeNode;
 
-static SgRbtNode* g_currentPickedRbtNode; // used later when you do picking
+namespace asd {
+    // How the robots are drawn: one shape per joint, or one skinned mesh each
+    enum class robot_look {
+        rigid, linear_blend, dual_quaternion, COUNT
+    };
+
+    // A robot's rigid part shapes, and the same parts as one skinned mesh
+    struct robot_skin {
+        std::shared_ptr<SgRbtNode> base;
+        std::vector<std::pair<std::shared_ptr<SgTransformNode>, std::shared_ptr<SgNode>>> parts; // joint, shape
+        std::shared_ptr<SkinnedGeometry> geometry;
+        std::unique_ptr<SkinRig> rig;
+        std::shared_ptr<MyShapeNode> shape;
+    };
+}
+
+static std::vector<asd::robot_skin> g_robot_skins;
+static asd::robot_look g_robot_look = asd::robot_look::rigid;
+
+static PoolHandle<SgRbtNode> g_currentPickedRbtNode; // stale, i.e. none, until something is picked
 static SgRbtNode* g_eye_node;
 
 // Vertex buffer and index buffer associated with the ground and cube geometry
@@ -282,13 +319,35 @@ static Mesh cube_reference_mesh{};
 static int subdivide_times = 0;
 static bool cube_do_smooth_shading = false;
 
+// When on, the cube is refined in the vertex shader from its 8 control points
+// (see SubdivStencilGeometry) instead of being subdivided and uploaded every frame.
+// Turned off in main and in the timer when the context cannot hold the stencils.
+static bool cube_use_gpu_subdivision = true;
+static std::shared_ptr<SubdivStencilGeometry> g_stencil_cube;
+
+// CPU path: the worker deforms, subdivides and packs the cube off the GL thread,
+// which only uploads the finished vertices into g_cpu_cube
+static std::unique_ptr<MeshRefineWorker> g_cube_worker;
+static std::shared_ptr<SimpleGeometryPN> g_cpu_cube;
+
 // --------- Scene
 
 static std::shared_ptr<SgRbtNode> g_light1Node, g_light2Node;
+// The lights the shaders see, binned into clusters per view
+static std::unique_ptr<LightManager> g_lights;
+// Small colored lights scattered above the ground, outside of g_world
+static std::vector<std::shared_ptr<SgRbtNode>> g_local_light_nodes;
+static bool g_local_lights = false;
 
 static std::unique_ptr<RigTForm> g_arcballRbt;
 
 static int camera_index = 0;
+static constexpr int camera_count = 3;
+
+// The cameras 'v' cycles through; camera i is also view i of g_flat_world
+static std::array<SgRbtNode*, camera_count> get_cameras() {
+    return {g_skyNode.get(), g_robot1Node.get(), g_robot2Node.get()};
+}
 
 
 namespace asd {
@@ -312,13 +371,14 @@ static double g_arcballScale = 0.001f;
 
 
 SgRbtNode* current_manipulating() {
-    if (g_currentPickedRbtNode == nullptr)
+    auto* picked = getNodePool<SgRbtNode>().get(g_currentPickedRbtNode);
+    if (picked == nullptr)
         return g_skyNode.get();
-    return g_currentPickedRbtNode;
+    return picked;
 }
 
 asd::manipulation_setting get_manipulation_setting() {
-    if (g_currentPickedRbtNode == nullptr) {
+    if (getNodePool<SgRbtNode>().get(g_currentPickedRbtNode) == nullptr) {
         if (g_eye_node != g_skyNode.get())
             return asd::manipulation_setting{false, RigTForm{}};
         auto sky_rbt_ref_world = getPathAccumRbt(g_world.get(), g_skyNode.get());
@@ -331,17 +391,33 @@ asd::manipulation_setting get_manipulation_setting() {
 }
 
 
+// Reorders the vertices and triangles for the vertex cache, then uses the compressed
+// vertex format (24 instead of 56 bytes per vertex) when the context can source it,
+// and the float one otherwise
+static std::shared_ptr<Geometry> makeIndexedGeometryPNTBX(const char* name, std::vector<GenericVertex> vtx,
+                                                          std::vector<unsigned short> idx) {
+    const VertexCacheStats stats = optimizeVertexCache(vtx, idx);
+    std::cout << name << ": ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter << std::endl;
+
+    if (packedVerticesSupported())
+        return std::make_shared<PackedIndexedGeometryPNTBX>(&vtx[0], &idx[0], vtx.size(), idx.size());
+
+    const auto unpacked = std::vector<VertexPNTBX>(vtx.begin(), vtx.end());
+    return std::make_shared<SimpleIndexedGeometryPNTBX>(&unpacked[0], &idx[0], unpacked.size(), idx.size());
+}
+
 static void initGround() {
     using namespace std;
     int ibLen, vbLen;
     getPlaneVbIbLen(vbLen, ibLen);
 
     // Temporary storage for cube Geometry
-    vector<VertexPNTBX> vtx(vbLen);
+    vector<GenericVertex> vtx;
+    vtx.reserve(vbLen);
     vector<unsigned short> idx(ibLen);
 
-    makePlane(g_groundSize * 2, vtx.begin(), idx.begin());
-    g_ground.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+    makePlane(g_groundSize * 2, back_inserter(vtx), idx.begin());
+    g_ground = makeIndexedGeometryPNTBX("ground", std::move(vtx), std::move(idx));
 }
 
 static void initCubeMesh() {
@@ -357,29 +433,39 @@ static void initCubeMesh() {
     ::cube_reference_mesh = mesh;
 }
 
-static void initCubes() {
-    using namespace std;
+// Vertices and indices of g_cube and g_sphere
+static void makeCubeVertices(std::vector<GenericVertex>& vtx, std::vector<unsigned short>& idx) {
     int ibLen, vbLen;
     getCubeVbIbLen(vbLen, ibLen);
-
-    // Temporary storage for cube Geometry
-    vector<VertexPNTBX> vtx(vbLen);
-    vector<unsigned short> idx(ibLen);
-
-    makeCube(1, vtx.begin(), idx.begin());
-    g_cube.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+    vtx.clear();
+    vtx.reserve(vbLen);
+    idx.resize(ibLen);
+    makeCube(1, back_inserter(vtx), idx.begin());
 }
 
-static void initSphere() {
-    using namespace std;
+static void makeSphereVertices(std::vector<GenericVertex>& vtx, std::vector<unsigned short>& idx) {
     int ibLen, vbLen;
     getSphereVbIbLen(20, 10, vbLen, ibLen);
+    vtx.clear();
+    vtx.reserve(vbLen);
+    idx.resize(ibLen);
+    makeSphere(1, 20, 10, back_inserter(vtx), idx.begin());
+}
+
+static void initCubes() {
+    // Temporary storage for cube Geometry
+    std::vector<GenericVertex> vtx;
+    std::vector<unsigned short> idx;
+    makeCubeVertices(vtx, idx);
+    g_cube = makeIndexedGeometryPNTBX("cube", std::move(vtx), std::move(idx));
+}
 
+static void initSphere() {
     // Temporary storage for sphere Geometry
-    vector<VertexPNTBX> vtx(vbLen);
-    vector<unsigned short> idx(ibLen);
-    makeSphere(1, 20, 10, vtx.begin(), idx.begin());
-    g_sphere.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vtx.size(), idx.size()));
+    std::vector<GenericVertex> vtx;
+    std::vector<unsigned short> idx;
+    makeSphereVertices(vtx, idx);
+    g_sphere = makeIndexedGeometryPNTBX("sphere", std::move(vtx), std::move(idx));
 }
 
 // takes a projection matrix and send to the the shaders
@@ -404,12 +490,144 @@ static Matrix4 makeProjectionMatrix() {
                                    g_frustFar);
 }
 
+// Names of the geometries and materials in scene files
+static SceneCatalog make_scene_catalog() {
+    auto catalog = SceneCatalog{};
+
+    // the animated cube's geometries are remade as it is refined, so they are all
+    // saved as "animated_cube", which loads as a plain cube; so its stencil
+    // materials, which do not fit a plain cube, are saved as those of the cube
+    if (g_stencil_cube)
+        catalog.add("animated_cube", g_stencil_cube);
+    if (g_cpu_cube)
+        catalog.add("animated_cube", g_cpu_cube);
+    catalog.add("animated_cube", g_cube);
+
+    catalog.add("ground", g_ground).add("cube", g_cube).add("sphere", g_sphere);
+    for (std::size_t i = 0; i < g_robot_skins.size(); i++)
+        catalog.add("robot_skin_" + std::to_string(i), g_robot_skins[i].geometry);
+
+    catalog.add("red_diffuse", g_redDiffuseMat).add("blue_diffuse", g_blueDiffuseMat)
+            .add("bump_floor", g_bumpFloorMat).add("arcball", g_arcballMat).add("picking", g_pickingMat)
+            .add("light", g_lightMat).add("cube", g_cubeStencilMat).add("cube", g_cubeMat)
+            .omitOverriding(g_pickingStencilMat);
+    return catalog;
+}
+
+// Swap the robots' rigid parts for their skinned meshes or back
+static void set_robot_look(asd::robot_look look) {
+    const auto skinned = [](asd::robot_look l) { return l != asd::robot_look::rigid; };
+    if (skinned(look) != skinned(g_robot_look)) {
+        for (auto& skin : g_robot_skins) {
+            for (auto& [joint, shape] : skin.parts) {
+                if (skinned(look))
+                    joint->removeChild(shape);
+                else
+                    joint->addChild(shape);
+            }
+            if (skinned(look))
+                skin.base->addChild(skin.shape);
+            else
+                skin.base->removeChild(skin.shape);
+        }
+    }
+    g_robot_look = look;
+    for (auto& skin : g_robot_skins) {
+        skin.rig->update();
+        skin.geometry->skin(&skin.rig->getSkinningRbts()[0],
+                            look == asd::robot_look::dual_quaternion ? SkinnedGeometry::DUAL_QUATERNION
+                                                                     : SkinnedGeometry::LINEAR_BLEND,
+                            g_frame_workers.get());
+        skin.shape->invalidateBounds();
+    }
+}
+
+// Skin the robots whose joints moved, if they are drawn skinned
+static void update_robot_skins() {
+    if (g_robot_look == asd::robot_look::rigid)
+        return;
+    for (auto& skin : g_robot_skins) {
+        if (!skin.rig->update())
+            continue;
+        skin.geometry->skin(&skin.rig->getSkinningRbts()[0],
+                            g_robot_look == asd::robot_look::dual_quaternion ? SkinnedGeometry::DUAL_QUATERNION
+                                                                             : SkinnedGeometry::LINEAR_BLEND,
+                            g_frame_workers.get());
+        skin.shape->invalidateBounds();
+    }
+}
+
+// Register the lights with g_lights: the two of g_world, which light everything,
+// and the local ones if they are on
+static void set_lights() {
+    g_lights->removeAllLights();
+    g_lights->addLight(g_light1Node, Cvec3(1));
+    g_lights->addLight(g_light2Node, Cvec3(1));
+    if (!g_local_lights)
+        return;
+    for (std::size_t i = 0; i < g_local_light_nodes.size(); ++i) {
+        const double hue = 6.0 * i / g_local_light_nodes.size();
+        const Cvec3 color(std::max(0.0, std::abs(hue - 3) - 1), std::max(0.0, 2 - std::abs(hue - 2)),
+                          std::max(0.0, 2 - std::abs(hue - 4)));
+        g_lights->addLight(g_local_light_nodes[i], color * 2, 1.5);
+    }
+}
+
+// Send the projection and the lights, binned for a camera drawing into a
+// viewport
+static void put_view_uniforms(Uniforms& uniforms, const RigTForm& invEyeRbt, const Matrix4& projmat,
+                              int x, int y, int width, int height) {
+    sendProjectionMatrix(uniforms, projmat);
+    g_lights->update(invEyeRbt, projmat, g_frustNear, g_frustFar);
+    g_lights->put(uniforms, x, y, width, height);
+}
+
+// Draw g_flat_world, updated for this frame, as seen from a camera into the
+// current viewport. Only the culling and submission are per camera.
+static void draw_view(int camera, const RigTForm& invEyeRbt, const Matrix4& projmat, const Frustum& frustum,
+                      Uniforms& uniforms) {
+    OcclusionBuffer* occlusion = nullptr;
+    if (g_occlusion_culling) {
+        occlusion = &g_occlusion[camera];
+        occlusion->update(invEyeRbt, projmat);
+    }
+    g_flat_world->draw(invEyeRbt, uniforms, &frustum, occlusion, camera);
+}
+
+// Split screen: the other cameras in insets of a third of the window along its
+// top right corner. They keep the window's aspect ratio, hence its projection.
+static void draw_insets(const Matrix4& projmat, const Frustum& frustum) {
+    const int w = g_windowWidth / 3, h = g_windowHeight / 3;
+    const auto cameras = get_cameras();
+    int x = g_windowWidth;
+    glEnable(GL_SCISSOR_TEST);
+    for (int camera = 0; camera < camera_count; ++camera) {
+        if (camera == camera_index)
+            continue;
+        x -= w;
+        glViewport(x, g_windowHeight - h, w, h);
+        glScissor(x, g_windowHeight - h, w, h);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        Uniforms uniforms;
+        const auto invEyeRbt = inv(getPathAccumRbt(g_world.get(), cameras[camera]));
+        put_view_uniforms(uniforms, invEyeRbt, projmat, x, g_windowHeight - h, w, h);
+        draw_view(camera, invEyeRbt, projmat, frustum, uniforms);
+    }
+    glDisable(GL_SCISSOR_TEST);
+    glViewport(0, 0, g_windowWidth, g_windowHeight);
+}
+
 static void drawStuff(bool picking) {
+    // the scene is updated once per frame, whatever the number of views
+    transforms().apply();
+    update_robot_skins();
+
     Uniforms uniforms;
 
     // build & send proj. matrix to vshader
     const Matrix4 projmat = makeProjectionMatrix();
-    sendProjectionMatrix(uniforms, projmat);
+    const Frustum frustum(projmat);
 
     // get SeyeRbt
     auto eye_rbt = getPathAccumRbt(g_world.get(), g_eye_node);
@@ -427,19 +645,12 @@ static void drawStuff(bool picking) {
 
 
     const auto invEyeRbt = inv(eye_rbt);
-
-    Cvec3 light1 = getPathAccumRbt(g_world.get(), g_light1Node.get()).getTranslation();
-    Cvec3 light2 = getPathAccumRbt(g_world.get(), g_light2Node.get()).getTranslation();
-
-    const Cvec3 eyeLight1 = Cvec3(invEyeRbt * Cvec4(light1, 1)); // g_light1 position in eye coordinates
-    const Cvec3 eyeLight2 = Cvec3(invEyeRbt * Cvec4(light2, 1)); // g_light2 position in eye coordinates
-    uniforms.put("uLight", eyeLight1);
-    uniforms.put("uLight2", eyeLight2);
+    put_view_uniforms(uniforms, invEyeRbt, projmat, 0, 0, g_windowWidth, g_windowHeight);
 
 
     if (!picking) {
-        Drawer drawer(invEyeRbt, uniforms);
-        g_world->accept(drawer);
+        g_flat_world->update();
+        draw_view(camera_index, invEyeRbt, projmat, frustum, uniforms);
 
         if (g_arcballRbt != nullptr) {
             const auto& arcballRbt = *g_arcballRbt;
@@ -452,14 +663,19 @@ static void drawStuff(bool picking) {
             // draw arcball
             Matrix4 MVM = rigTFormToMatrix(invEyeRbt * arcballRbt)
                           * Matrix4::makeScale(Cvec3{g_arcballScale * g_arcballScreenRadius});
+            if (const auto* decode = g_sphere->getPositionDecode(); decode != nullptr)
+                MVM = MVM * *decode;
             Matrix4 NMVM = normalMatrix(MVM);
 
             sendModelViewNormalMatrix(uniforms, MVM, NMVM);
             g_arcballMat->draw(*g_sphere, uniforms);
         }
+
+        if (g_split_screen)
+            draw_insets(projmat, frustum);
     }
     else {
-        Picker picker(invEyeRbt, uniforms);
+        Picker picker(invEyeRbt, uniforms, &frustum);
 
         g_overridingMaterial = g_pickingMat;
         g_world->accept(picker);
@@ -468,14 +684,14 @@ static void drawStuff(bool picking) {
         glFlush();
 
         auto* selected = picker.getRbtNodeAtXY(g_mouseClickX, g_mouseClickY).get();
-        if (selected == g_groundNode.get()) {
-            g_currentPickedRbtNode = nullptr;   // set to NULL
+        if (selected == g_groundNode.get() || selected == g_pillarNode.get()) {
+            g_currentPickedRbtNode = PoolHandle<SgRbtNode>{};   // nothing picked
         }
         else {
-            g_currentPickedRbtNode = selected;
+            g_currentPickedRbtNode = getNodePool<SgRbtNode>().getHandle(selected);
         }
 
-        if (g_currentPickedRbtNode == nullptr) {
+        if (getNodePool<SgRbtNode>().get(g_currentPickedRbtNode) == nullptr) {
             std::cout << "No part picked\n";
         }
         else {
@@ -571,7 +787,9 @@ static void motion(const int x, const int y) {
     if (g_mouseClickDown) {
         const auto& settings = ::get_manipulation_setting();
         if (settings.can_manipulate) {
-            const auto& target_rbt = ::current_manipulating()->getRbt();
+            auto& store = transforms();
+            const auto slot = store.getSlot(::current_manipulating());
+            const auto target_rbt = store.get(slot);
             bool invert_translation = false;
             bool invert_linear = false;
 
@@ -596,9 +814,9 @@ static void motion(const int x, const int y) {
             }
 
             auto rbt_parent_frame_ref_world = getPathAccumRbt(g_world.get(), ::current_manipulating(), 1);
-            ::current_manipulating()->setRbt(
-                    inv(rbt_parent_frame_ref_world) * settings.respect_frame * rigT * inv(settings.respect_frame) *
-                    rbt_parent_frame_ref_world * target_rbt);
+            store.set(slot, inv(rbt_parent_frame_ref_world) * settings.respect_frame * rigT *
+                            inv(settings.respect_frame) * rbt_parent_frame_ref_world * target_rbt);
+            store.publish();
             glutPostRedisplay(); // we always redraw if we changed the scene
         }
     }
@@ -644,6 +862,7 @@ static void keyboard(const unsigned char key, const int x, const int y) {
     };
 
     const auto save_filename = std::string{"animation.txt"};
+    const auto scene_filename = std::string{"scene.sgsf"};
     auto print_subdivision_steps = []() {
         std::cout << "number of subdivision steps: " << ::subdivide_times << std::endl;
     };
@@ -659,6 +878,12 @@ static void keyboard(const unsigned char key, const int x, const int y) {
                       << "s\t\tsave screenshot\n"
                       << "f\t\tToggle flat shading on/off.\n" << "o\t\tCycle object to edit\n"
                       << "v\t\tCycle view\n"
+                      << "x\t\tToggle split screen: the other views in insets, which cannot be picked\n"
+                      << "g\t\tToggle GPU/CPU cube subdivision\n"
+                      << "e\t\tSave the scene to scene.sgsf, which can be passed on the command line\n"
+                      << "k\t\tCycle robots between rigid parts and linear blend / dual quaternion skinning\n"
+                      << "c\t\tToggle occlusion culling on/off\n"
+                      << "l\t\tToggle 64 small colored lights above the ground\n"
                       << "drag left mouse to rotate\n" << std::endl;
             break;
         case 's':
@@ -666,11 +891,19 @@ static void keyboard(const unsigned char key, const int x, const int y) {
             writePpmScreenshot(g_windowWidth, g_windowHeight, "out.ppm");
             break;
         case 'v': {
-            constexpr int candidates_count = 3;
-            static const std::array<SgRbtNode*, candidates_count> candidates{::g_skyNode.get(), ::g_robot1Node.get(),
-                                                                             ::g_robot2Node.get()};
-            camera_index = (camera_index + 1) % candidates_count;
-            g_eye_node = candidates[camera_index];
+            camera_index = (camera_index + 1) % camera_count;
+            g_eye_node = get_cameras()[camera_index];
+            break;
+        }
+        case 'l': {
+            g_local_lights = !g_local_lights;
+            set_lights();
+            std::cout << "Local lights are " << (g_local_lights ? "on" : "off") << std::endl;
+            break;
+        }
+        case 'x': {
+            g_split_screen = !g_split_screen;
+            std::cout << "Split screen is " << (g_split_screen ? "on" : "off") << std::endl;
             break;
         }
 //        case 'o': {
@@ -821,6 +1054,37 @@ static void keyboard(const unsigned char key, const int x, const int y) {
             std::cout << "smooth shading " << (::cube_do_smooth_shading ? "on" : "off") << std::endl;
             break;
         }
+        case 'g': {
+            if (!SubdivStencilGeometry::isSupported()) {
+                std::cout << "GPU subdivision is not supported by this context" << std::endl;
+                break;
+            }
+            ::cube_use_gpu_subdivision = !::cube_use_gpu_subdivision;
+            std::cout << "cube subdivision on " << (::cube_use_gpu_subdivision ? "GPU" : "CPU") << std::endl;
+            break;
+        }
+        case 'e': {
+            try {
+                saveScene(scene_filename, *g_world, make_scene_catalog());
+                std::cout << "saved scene to " << scene_filename << std::endl;
+            } catch (const std::runtime_error& e) {
+                std::cout << "Cannot save scene: " << e.what() << std::endl;
+            }
+            break;
+        }
+        case 'k': {
+            static const char* const names[] = {"rigid parts", "linear blend skinning", "dual quaternion skinning"};
+            const auto look = asd::robot_look((static_cast<int>(g_robot_look) + 1) %
+                                              static_cast<int>(asd::robot_look::COUNT));
+            set_robot_look(look);
+            std::cout << "robots drawn as " << names[static_cast<int>(look)] << std::endl;
+            break;
+        }
+        case 'c': {
+            g_occlusion_culling = !g_occlusion_culling;
+            std::cout << "Occlusion culling is " << (g_occlusion_culling ? "on" : "off") << std::endl;
+            break;
+        }
         case '0': {
             ::subdivide_times = std::min(::subdivide_times + 1, 6);
             print_subdivision_steps();
@@ -879,6 +1143,12 @@ static void initMaterials() {
     Material solid("./shaders/basic-gl3.vshader", "./shaders/solid-gl3.fshader");
     Material specular("./shaders/basic-gl3.vshader", "./shaders/specular-gl3.fshader");
 
+    // robot parts and lights share geometry, so they can be drawn instanced
+    if (instancingSupported()) {
+        diffuse.enableInstancing("./shaders/basic-instanced-gl3.vshader");
+        solid.enableInstancing("./shaders/basic-instanced-gl3.vshader");
+    }
+
     // copy diffuse prototype and set red color
     g_redDiffuseMat.reset(new Material(diffuse));
     g_redDiffuseMat->getUniforms().put("uColor", Cvec3f(1, 0, 0));
@@ -905,8 +1175,14 @@ static void initMaterials() {
     g_cubeMat.reset(new Material(specular));
     g_cubeMat->getUniforms().put("uColor", Cvec3f(1, 1, 0));
 
+    // the GPU subdivided cube evaluates its vertices from stencils, so it needs
+    // its own vertex shader for both shading and picking
+    g_cubeStencilMat.reset(new Material("./shaders/stencil-gl3.vshader", "./shaders/specular-gl3.fshader"));
+    g_cubeStencilMat->getUniforms().put("uColor", Cvec3f(1, 1, 0));
+
     // pick shader
     g_pickingMat.reset(new Material("./shaders/basic-gl3.vshader", "./shaders/pick-gl3.fshader"));
+    g_pickingStencilMat.reset(new Material("./shaders/stencil-gl3.vshader", "./shaders/pick-gl3.fshader"));
 };
 
 static void initGeometry() {
@@ -915,34 +1191,31 @@ static void initGeometry() {
     initSphere();
 }
 
-static void constructRobot(std::shared_ptr<SgTransformNode> base, std::shared_ptr<Material> material) {
+static constexpr float ARM_LEN = 0.7,
+        ARM_THICK = 0.25,
+        TORSO_LEN = 1.5,
+        TORSO_THICK = 0.25,
+        TORSO_WIDTH = 1;
+
+// the robot rig, joint 0 being the robot's own node
+static constexpr JointDesc ROBOT_JOINTS[] = {
+        {"torso",           -1},
+        {"upper_right_arm", 0, TORSO_WIDTH / 2,  (TORSO_LEN / 2),  0},
+        {"lower_right_arm", 1, ARM_LEN + 0.05f,  0,                0},
+        {"upper_left_arm",  0, -TORSO_WIDTH / 2, (TORSO_LEN / 2),  0},
+        {"lower_left_arm",  3, -ARM_LEN - 0.05f, 0,                0},
+        {"head",            0, 0,                TORSO_LEN / 2,    0},
+        {"upper_right_leg", 0, TORSO_WIDTH / 2,  -(TORSO_LEN / 2), 0},
+        {"lower_right_leg", 6, 0,                -ARM_LEN - 0.05f, 0},
+        {"upper_left_leg",  0, -TORSO_WIDTH / 2, -(TORSO_LEN / 2), 0},
+        {"lower_left_leg",  8, 0,                -ARM_LEN - 0.05f, 0},
+};
 
-    const float ARM_LEN = 0.7,
-            ARM_THICK = 0.25,
-            TORSO_LEN = 1.5,
-            TORSO_THICK = 0.25,
-            TORSO_WIDTH = 1;
-    const int NUM_JOINTS = 10,
+static void constructRobot(std::shared_ptr<SgRbtNode> base, std::shared_ptr<Material> material) {
+    static const auto skeleton = std::make_shared<const Skeleton>(ROBOT_JOINTS);
+    const int NUM_JOINTS = skeleton->getNumJoints(),
             NUM_SHAPES = 10;
 
-    struct JointDesc {
-        int parent;
-        float x, y, z;
-    };
-
-    JointDesc jointDesc[NUM_JOINTS] = {
-            {-1}, // torso
-            {0, TORSO_WIDTH / 2,  (TORSO_LEN / 2),  0}, // upper right arm
-            {1, ARM_LEN + 0.05f,  0,                0}, // lower right arm
-            {0, -TORSO_WIDTH / 2, (TORSO_LEN / 2),  0}, // upper left arm
-            {3, -ARM_LEN - 0.05f, 0,                0}, // lower left arm
-            {0, 0,                TORSO_LEN / 2,    0}, // head
-            {0, TORSO_WIDTH / 2,  -(TORSO_LEN / 2), 0}, // upper right leg
-            {6, 0,                -ARM_LEN - 0.05f, 0}, // lower right leg
-            {0, -TORSO_WIDTH / 2, -(TORSO_LEN / 2), 0}, // upper left leg
-            {8, 0,                -ARM_LEN - 0.05f, 0}, // lower left leg
-    };
-
     struct ShapeDesc {
         int parentJointId;
         float x, y, z, sx, sy, sz;
@@ -966,57 +1239,110 @@ static void constructRobot(std::shared_ptr<SgTransformNode> base, std::shared_pt
             {9, 0,              -(ARM_LEN / 2), 0, (ARM_THICK),   (ARM_LEN),   (ARM_THICK),   g_cube}, // lower left arm
     };
 
-    std::shared_ptr<SgTransformNode> jointNodes[NUM_JOINTS];
+    // one SgRbtNode per joint, so that joints can be picked and keyframed
+    std::vector<std::shared_ptr<SgRbtNode>> jointNodes(NUM_JOINTS);
 
     for (int i = 0; i < NUM_JOINTS; ++i) {
-        if (auto parent = jointDesc[i].parent; parent == -1)
+        if (auto parent = skeleton->getParent(i); parent == -1)
             jointNodes[i] = base;
         else {
-            jointNodes[i].reset(new SgRbtNode(RigTForm(Cvec3(jointDesc[i].x, jointDesc[i].y, jointDesc[i].z))));
+            jointNodes[i] = makePooledNode<SgRbtNode>(skeleton->getBindPose(i));
             jointNodes[parent]->addChild(jointNodes[i]);
         }
     }
 
+    auto skin = asd::robot_skin{};
+    skin.base = base;
     for (auto& i : shapeDesc) {
-        std::shared_ptr<MyShapeNode> shape{
-                new MyShapeNode(i.geometry,
-                                material,
-                                Cvec3(i.x, i.y, i.z),
-                                Cvec3(0, 0, 0),
-                                Cvec3(i.sx, i.sy, i.sz))};
+        auto shape = makePooledNode<MyShapeNode>(i.geometry,
+                                                 material,
+                                                 Cvec3(i.x, i.y, i.z),
+                                                 Cvec3(0, 0, 0),
+                                                 Cvec3(i.sx, i.sy, i.sz));
         jointNodes[i.parentJointId]->addChild(shape);
+        skin.parts.emplace_back(jointNodes[i.parentJointId], shape);
+    }
+
+    // the same parts as one mesh in the robot's frame, each vertex bound to its
+    // part's joint
+    auto skin_vertices = std::vector<SkinVertex>{};
+    auto skin_indices = std::vector<unsigned>{};
+    auto vtx = std::vector<GenericVertex>{};
+    auto idx = std::vector<unsigned short>{};
+    for (auto& i : shapeDesc) {
+        if (i.geometry == g_sphere)
+            makeSphereVertices(vtx, idx);
+        else
+            makeCubeVertices(vtx, idx);
+        const auto bind = rigTFormToMatrix(getPathAccumRbt(base.get(), jointNodes[i.parentJointId].get())) *
+                          Matrix4::makeTranslation(Cvec3(i.x, i.y, i.z)) *
+                          Matrix4::makeScale(Cvec3(i.sx, i.sy, i.sz));
+        const auto normal_bind = normalMatrix(bind);
+        const auto first = static_cast<unsigned>(skin_vertices.size());
+        for (auto& v : vtx) {
+            const auto p = bind * Cvec4(v.pos[0], v.pos[1], v.pos[2], 1);
+            const auto n = normalize(Cvec3(normal_bind * Cvec4(v.normal[0], v.normal[1], v.normal[2], 0)));
+            auto sv = SkinVertex{};
+            sv.p = Cvec3f(p[0], p[1], p[2]);
+            sv.n = Cvec3f(n[0], n[1], n[2]);
+            sv.joints[0] = i.parentJointId;
+            sv.weights[0] = 1;
+            skin_vertices.push_back(sv);
+        }
+        for (auto index : idx)
+            skin_indices.push_back(first + index);
     }
+    skin.geometry = std::make_shared<SkinnedGeometry>(&skin_vertices[0], &skin_indices[0], skin_vertices.size(),
+                                                      skin_indices.size(), NUM_JOINTS);
+    auto joints = std::vector<SgRbtNode*>{};
+    for (auto& joint : jointNodes)
+        joints.push_back(joint.get());
+    skin.rig = std::make_unique<SkinRig>(base.get(), skeleton, joints);
+    skin.shape = makePooledNode<MyShapeNode>(skin.geometry, material);
+    g_robot_skins.push_back(std::move(skin));
 }
 
 static void initScene() {
-    g_world.reset(new SgRootNode());
+    // nodes live in per type pools, see nodepool.h
+    g_world = makePooledNode<SgRootNode>();
 
-    g_skyNode.reset(new SgRbtNode(RigTForm(Cvec3(0.0, 0.25, 4.0))));
+    g_skyNode = makePooledNode<SgRbtNode>(RigTForm(Cvec3(0.0, 0.25, 4.0)));
 
-    g_groundNode.reset(new SgRbtNode());
-    g_groundNode->addChild(std::make_shared<MyShapeNode>(
+    g_groundNode = makePooledNode<SgRbtNode>();
+    g_groundNode->addChild(makePooledNode<MyShapeNode>(
             g_ground, g_bumpFloorMat, Cvec3(0, g_groundY, 0)));
 
-    g_robot1Node.reset(new SgRbtNode(RigTForm(Cvec3(-6, 1, 0))));
-    g_robot2Node.reset(new SgRbtNode(RigTForm(Cvec3(6, 1, 0))));
+    g_pillarNode = makePooledNode<SgRbtNode>(RigTForm(Cvec3(-3.5, g_groundY + g_pillarSize[1] / 2, -1.5)));
+    g_pillarNode->addChild(makePooledNode<MyShapeNode>(
+            g_cube, g_bumpFloorMat, Cvec3(0), Cvec3(0), g_pillarSize));
+
+    g_robot1Node = makePooledNode<SgRbtNode>(RigTForm(Cvec3(-6, 1, 0)));
+    g_robot2Node = makePooledNode<SgRbtNode>(RigTForm(Cvec3(6, 1, 0)));
 
     constructRobot(g_robot1Node, g_redDiffuseMat); // a Red robot
     constructRobot(g_robot2Node, g_blueDiffuseMat); // a Blue robot
 
 //    static const Cvec3 g_light1(2.0, 3.0, 14.0), g_light2(-2, -3.0, -5.0);  // define two lights positions in world space
-    g_light1Node.reset(new SgRbtNode{RigTForm{Cvec3{4., 3., 3.}}});
-    g_light2Node.reset(new SgRbtNode{RigTForm{Cvec3{-4., 1.5, -3.}}});
-    g_light1Node->addChild(std::make_shared<MyShapeNode>(g_sphere, g_lightMat, Cvec3{0, 0, 0}, Cvec3{0}, Cvec3{0.5}));
-    g_light2Node->addChild(std::make_shared<MyShapeNode>(g_sphere, g_lightMat, Cvec3{0, 0, 0}, Cvec3{0}, Cvec3{0.5}));
+    g_light1Node = makePooledNode<SgRbtNode>(RigTForm{Cvec3{4., 3., 3.}});
+    g_light2Node = makePooledNode<SgRbtNode>(RigTForm{Cvec3{-4., 1.5, -3.}});
+    g_light1Node->addChild(makePooledNode<MyShapeNode>(g_sphere, g_lightMat, Cvec3{0, 0, 0}, Cvec3{0}, Cvec3{0.5}));
+    g_light2Node->addChild(makePooledNode<MyShapeNode>(g_sphere, g_lightMat, Cvec3{0, 0, 0}, Cvec3{0}, Cvec3{0.5}));
 
+    // rarely moved, so g_flat_world bakes them together (see StaticBatch)
+    g_groundNode->setStatic(true);
+    g_pillarNode->setStatic(true);
+    g_light1Node->setStatic(true);
+    g_light2Node->setStatic(true);
 
-    g_cubeNode.reset(new SgRbtNode{RigTForm{Cvec3{0, 0, 0}}});
-    g_cubeShapeNode = std::make_shared<MyShapeNode>(g_mesh_cube, g_cubeMat);
+
+    g_cubeNode = makePooledNode<SgRbtNode>(RigTForm{Cvec3{0, 0, 0}});
+    g_cubeShapeNode = makePooledNode<MyShapeNode>(g_mesh_cube, g_cubeMat);
     g_cubeNode->addChild(g_cubeShapeNode);
 
 
     g_world->addChild(g_skyNode);
     g_world->addChild(g_groundNode);
+    g_world->addChild(g_pillarNode);
     g_world->addChild(g_robot1Node);
     g_world->addChild(g_robot2Node);
     g_world->addChild(g_light1Node);
@@ -1025,23 +1351,47 @@ static void initScene() {
 }
 
 
+// Frames hold one rbt per channel of g_channels, which are the slots of g_transforms
 static void load_frame(asd::frame& frame) {
-    auto nodes_list = dumpSgRbtNodes(::g_world);
-    for (int i = 0; i < std::min(nodes_list.size(), frame.rbt_states.size()); i++) {
-        nodes_list[i]->setRbt(frame.rbt_states[i]);
+    auto& store = transforms();
+    const auto count = std::min(static_cast<std::size_t>(store.getNumSlots()), frame.rbt_states.size());
+    for (std::size_t i = 0; i < count; i++) {
+        store.set(static_cast<int>(i), frame.rbt_states[i]);
     }
+    store.publish();
     glutPostRedisplay();
 }
 
 
 static asd::frame save_frame() {
+    const auto& store = transforms();
     auto ret = asd::frame{};
-    for (auto&& node: dumpSgRbtNodes(::g_world)) {
-        ret.rbt_states.push_back(node->getRbt());
+    ret.rbt_states.reserve(store.getNumSlots());
+    for (int i = 0; i < store.getNumSlots(); i++) {
+        ret.rbt_states.push_back(store.get(i));
     }
     return ret;
 }
 
+// Corners of a box of the given size centered at the origin, like the scaled
+// g_cube, as occluder vertices; corner i has the max coordinate along the axes
+// of the set bits of i
+static std::vector<Cvec3f> box_occluder_vertices(const Cvec3& size) {
+    auto vertices = std::vector<Cvec3f>{};
+    for (int i = 0; i < 8; ++i) {
+        vertices.push_back(Cvec3f(float(i & 1 ? size[0] / 2 : -size[0] / 2),
+                                  float(i & 2 ? size[1] / 2 : -size[1] / 2),
+                                  float(i & 4 ? size[2] / 2 : -size[2] / 2)));
+    }
+    return vertices;
+}
+
+// The faces of box_occluder_vertices, two triangles each
+static std::vector<unsigned> box_occluder_indices() {
+    return {0, 2, 6, 0, 6, 4, 1, 3, 7, 1, 7, 5,
+            0, 1, 5, 0, 5, 4, 2, 3, 7, 2, 7, 6,
+            0, 1, 3, 0, 3, 2, 4, 5, 7, 4, 7, 6};
+}
 
 int main(int argc, char* argv[]) {
     try {
@@ -1049,10 +1399,10 @@ int main(int argc, char* argv[]) {
 
         glewInit(); // load the OpenGL extensions
 
-        std::cout << (g_Gl2Compatible ? "Will use OpenGL 2.x / GLSL 1.0" : "Will use OpenGL 3.x / GLSL 1.3")
+        std::cout << (g_Gl2Compatible ? "Will use OpenGL 2.x / GLSL 1.0" : "Will use OpenGL 3.1 / GLSL 1.4")
                   << std::endl;
-        if ((!g_Gl2Compatible) && !GLEW_VERSION_3_0)
-            throw std::runtime_error("Error: card/driver does not support OpenGL Shading Language v1.3");
+        if ((!g_Gl2Compatible) && !GLEW_VERSION_3_1)
+            throw std::runtime_error("Error: card/driver does not support OpenGL Shading Language v1.4");
         else if (g_Gl2Compatible && !GLEW_VERSION_2_0)
             throw std::runtime_error("Error: card/driver does not support OpenGL Shading Language v1.0");
 
@@ -1060,7 +1410,45 @@ int main(int argc, char* argv[]) {
         initMaterials();
         initGeometry();
         initScene();
+        if (argc > 1) {
+            // a scene saved with 'e', added to the built-in one
+            g_world->addChild(loadScene(argv[1], make_scene_catalog()));
+        }
+        g_channels.reset(new RbtChannelBinding(g_world));
+        g_transforms.reset(new TransformStore(g_channels->getNodes()));
+        g_frame_workers.reset(new WorkerPool());
+        g_flat_world.reset(new FlatScene(g_world, g_frame_workers.get()));
+        g_lights.reset(new LightManager());
+        for (int i = 0; i < 64; ++i) {
+            // a grid over the ground, jittered by a fixed pattern
+            const double x = -g_groundSize + (i % 8 + 0.5 + 0.3 * std::sin(i * 2.1)) * g_groundSize / 4;
+            const double z = -g_groundSize + (i / 8 + 0.5 + 0.3 * std::cos(i * 1.7)) * g_groundSize / 4;
+            g_local_light_nodes.push_back(makePooledNode<SgRbtNode>(RigTForm(Cvec3(x, g_groundY + 0.4, z))));
+        }
+        set_lights();
+        g_occlusion.assign(camera_count, OcclusionBuffer(128, 128));
+        const auto cameras = get_cameras();
+        for (int camera = 0; camera < camera_count; ++camera) {
+            auto& occlusion = g_occlusion[camera];
+            // the ground quad hides whatever lies below it
+            occlusion.addOccluder(g_groundNode,
+                                  {Cvec3f(-g_groundSize, g_groundY, -g_groundSize),
+                                   Cvec3f(-g_groundSize, g_groundY, g_groundSize),
+                                   Cvec3f(g_groundSize, g_groundY, g_groundSize),
+                                   Cvec3f(g_groundSize, g_groundY, -g_groundSize)},
+                                  {0, 1, 2, 0, 2, 3});
+            // the pillar, in the sky view the second light behind it
+            occlusion.addOccluder(g_pillarNode, box_occluder_vertices(g_pillarSize), box_occluder_indices());
+            // and the robots' torsos, except for the robot's own eye which lies inside its torso
+            for (const auto& robot : {g_robot1Node, g_robot2Node}) {
+                if (robot.get() != cameras[camera])
+                    occlusion.addOccluder(robot, box_occluder_vertices(Cvec3(TORSO_WIDTH, TORSO_LEN, TORSO_THICK)),
+                                          box_occluder_indices());
+            }
+        }
         initCubeMesh();
+        g_cube_worker.reset(new MeshRefineWorker(cube_reference_mesh, asd::wobble_cube));
+        ::cube_use_gpu_subdivision = ::cube_use_gpu_subdivision && SubdivStencilGeometry::isSupported();
 
         g_eye_node = g_skyNode.get();
         ::current_frame_iter = ::animation.begin();
@@ -1127,7 +1515,9 @@ static bool show_animation_at_time(float t) {
         const auto rbt_state_size = std::get<0>(surrounding_rbts).size();
 
 
-        auto interpolated_frame = asd::frame{std::vector<RigTForm>(rbt_state_size)};
+        // reused from tick to tick, playback then allocates nothing
+        static auto interpolated_frame = asd::frame{};
+        interpolated_frame.rbt_states.resize(rbt_state_size);
 
 
         for (std::size_t i = 0; i < rbt_state_size; i++) {
@@ -1204,74 +1594,52 @@ static void animate_timer_callback(int ms) {
 static void asd::animate_cube_timer_callback(int step) {
     auto dt = 15;
 
-    auto cube_mesh = cube_reference_mesh; // copy reference mesh
-
-    for (int i = 0; i < cube_mesh.getNumVertices(); i++) {
-        auto&& v = cube_mesh.getVertex(i);
-        v.setPosition(v.getPosition() * (0.5 * (1.01 + std::sin(0.0001 * step * (0.7 + i / 13.)))));
-    }
-    for (int i = 0; i < ::subdivide_times; i++) {
-        subdivide(cube_mesh);
+    if (::cube_use_gpu_subdivision && (::g_stencil_cube == nullptr || ::g_stencil_cube->getLevels() != ::subdivide_times)) {
+        try {
+            ::g_stencil_cube = std::make_shared<SubdivStencilGeometry>(cube_reference_mesh, ::subdivide_times);
+        }
+        catch (const std::runtime_error& e) {
+            // typically too many stencils for the buffer texture at this level
+            std::cout << e.what() << "; cube subdivision on CPU" << std::endl;
+            ::g_stencil_cube.reset();
+            ::cube_use_gpu_subdivision = false;
+        }
     }
 
-    set_averaged_normals(cube_mesh);
-
-    ::g_cubeShapeNode->geometry.reset(
-            new SimpleGeometryPN{transform_to_simpleGeometryPN(cube_mesh, cube_do_smooth_shading)});
-    glutPostRedisplay();
-
-
-//    auto dt = static_cast<unsigned int>(1000. / );
-    glutTimerFunc(dt, animate_cube_timer_callback, static_cast<int>(step + cube_animation_speed * dt));
-}
-
-void asd::subdivide(Mesh& mesh) {
-
-    // add face-vertices
-    for (int fi = 0; fi < mesh.getNumFaces(); fi++) {
-        auto&& face = mesh.getFace(fi);
-
-        auto accum = Cvec3{};
-        for (int fvi = 0; fvi < face.getNumVertices(); fvi++) {
-            accum += face.getVertex(fvi).getPosition();
+    if (::cube_use_gpu_subdivision) {
+        // only the control cage changes per frame, the refinement happens in the vertex shader
+        auto cage = std::vector<Cvec3>(cube_reference_mesh.getNumVertices());
+        for (int i = 0; i < static_cast<int>(cage.size()); i++) {
+            cage[i] = cube_reference_mesh.getVertex(i).getPosition();
         }
-        accum /= face.getNumVertices();
-        mesh.setNewFaceVertex(face, accum);
+        cube_deformers().apply(&cage[0], static_cast<int>(cage.size()), step);
+        ::g_stencil_cube->setCage(&cage[0], static_cast<int>(cage.size()));
+        ::g_stencil_cube->setSmoothShading(cube_do_smooth_shading);
+
+        ::g_cubeShapeNode->geometry = ::g_stencil_cube;
+        ::g_cubeShapeNode->material = ::g_cubeStencilMat;
+        ::g_cubeShapeNode->overridingMaterial = ::g_pickingStencilMat;
+        ::g_cubeShapeNode->invalidateBounds();
+        glutPostRedisplay();
     }
-
-    // add edge-vertices
-    for (int ei = 0; ei < mesh.getNumEdges(); ei++) {
-        auto&& edge = mesh.getEdge(ei);
-        auto const& v1 = edge.getVertex(0).getPosition();
-        auto const& v2 = edge.getVertex(1).getPosition();
-        auto const& vf1 = mesh.getNewFaceVertex(edge.getFace(0));
-        auto const& vf2 = mesh.getNewFaceVertex(edge.getFace(1));
-        auto edge_vertex_pos = Cvec3{(v1 + v2 + vf1 + vf2)} / 4;
-        mesh.setNewEdgeVertex(edge, edge_vertex_pos);
+    else {
+        ::g_cube_worker->request(MeshRefineWorker::Job{step, ::subdivide_times, cube_do_smooth_shading});
+
+        // keep showing the previous frame until the worker has a new one
+        if (const auto* vertices = ::g_cube_worker->acquireLatest(); vertices != nullptr && !vertices->empty()) {
+            if (::g_cpu_cube == nullptr)
+                ::g_cpu_cube = std::make_shared<SimpleGeometryPN>();
+            ::g_cpu_cube->upload(&(*vertices)[0], static_cast<int>(vertices->size()));
+
+            ::g_cubeShapeNode->geometry = ::g_cpu_cube;
+            ::g_cubeShapeNode->material = ::g_cubeMat;
+            ::g_cubeShapeNode->overridingMaterial.reset();
+            ::g_cubeShapeNode->invalidateBounds();
+            glutPostRedisplay();
+        }
     }
 
-    // add vertice-vertices
-    for (int vi = 0; vi < mesh.getNumVertices(); vi++) {
-        auto&& vertex = mesh.getVertex(vi);
-        auto it = vertex.getIterator();
-        auto it0 = it;
-        auto nv = 0;
-        auto face_vertex_sum = Cvec3{};
-        auto adjacent_vertex_sum = Cvec3{};
-        do {
-            ++nv;
-            face_vertex_sum += mesh.getNewFaceVertex(it.getFace());
-            adjacent_vertex_sum += it.getVertex().getPosition();
-            ++it;
-        } while (it != it0);
-
-        auto new_v_pos = Cvec3{
-                vertex.getPosition() * (static_cast<double>(nv - 2) / nv) + adjacent_vertex_sum / (nv * nv) +
-                face_vertex_sum / (nv * nv)};
-
-        mesh.setNewVertexVertex(vertex, new_v_pos);
-    }
 
-    mesh.subdivide();
+//    auto dt = static_cast<unsigned int>(1000. / );
+    glutTimerFunc(dt, animate_cube_timer_callback, static_cast<int>(step + cube_animation_speed * dt));
 }
-
@@ -0,0 +1,130 @@
+#include <cmath>
+#include <algorithm>
+
+#include "bounds.h"
+
+using namespace std;
+
+Bounds Bounds::fromPoints(const Cvec3* points, int numPoints) {
+    Bounds b;
+    if (numPoints <= 0)
+        return b;
+
+    b.empty_ = false;
+    b.boxMin_ = b.boxMax_ = points[0];
+    for (int i = 1; i < numPoints; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            b.boxMin_[j] = min(b.boxMin_[j], points[i][j]);
+            b.boxMax_[j] = max(b.boxMax_[j], points[i][j]);
+        }
+    }
+    b.center_ = (b.boxMin_ + b.boxMax_) * 0.5;
+    double radius2 = 0;
+    for (int i = 0; i < numPoints; ++i)
+        radius2 = max(radius2, norm2(points[i] - b.center_));
+    b.radius_ = sqrt(radius2);
+    return b;
+}
+
+void Bounds::extend(const Bounds& other) {
+    if (other.empty_ || infinite_)
+        return;
+    if (empty_ || other.infinite_) {
+        *this = other;
+        return;
+    }
+
+    for (int j = 0; j < 3; ++j) {
+        boxMin_[j] = min(boxMin_[j], other.boxMin_[j]);
+        boxMax_[j] = max(boxMax_[j], other.boxMax_[j]);
+    }
+
+    // smallest sphere enclosing both spheres
+    const Cvec3 offset = other.center_ - center_;
+    const double distance = norm(offset);
+    if (distance + other.radius_ <= radius_)
+        return;
+    if (distance + radius_ <= other.radius_) {
+        center_ = other.center_;
+        radius_ = other.radius_;
+        return;
+    }
+    const double radius = (distance + radius_ + other.radius_) * 0.5;
+    center_ += offset * ((radius - radius_) / distance);
+    radius_ = radius;
+}
+
+Bounds Bounds::transformed(const Matrix4& m) const {
+    if (empty_ || infinite_)
+        return *this;
+
+    // Arvo's method: each output extent is the sum of the extremes of the
+    // matrix entries times the input extents
+    Bounds b;
+    b.empty_ = false;
+    double maxScale2 = 0;
+    for (int i = 0; i < 3; ++i) {
+        b.boxMin_[i] = b.boxMax_[i] = m(i, 3);
+        double scale2 = 0;
+        for (int j = 0; j < 3; ++j) {
+            const double lo = m(i, j) * boxMin_[j], hi = m(i, j) * boxMax_[j];
+            b.boxMin_[i] += min(lo, hi);
+            b.boxMax_[i] += max(lo, hi);
+            scale2 += m(j, i) * m(j, i);
+        }
+        maxScale2 = max(maxScale2, scale2);
+    }
+
+    const Cvec4 center = m * Cvec4(center_, 1);
+    b.center_ = Cvec3(center[0], center[1], center[2]);
+    b.radius_ = radius_ * sqrt(maxScale2);
+    return b;
+}
+
+Frustum::Frustum(const Matrix4& projection) {
+    // Gribb and Hartmann: a point is inside if -w <= x, y, z <= w in clip space,
+    // so each plane is the last row of the matrix plus or minus another row
+    for (int i = 0; i < 3; ++i) {
+        for (int k = 0; k < 2; ++k) {
+            const double sign = k == 0 ? 1 : -1;
+            Cvec4 plane;
+            for (int j = 0; j < 4; ++j)
+                plane[j] = projection(3, j) + sign * projection(i, j);
+            const double length = sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            planes_[i * 2 + k] = length > CS175_EPS ? plane / length : plane;
+        }
+    }
+}
+
+bool Frustum::isOutside(const Bounds& eyeBounds) const {
+    if (eyeBounds.isEmpty())
+        return true;
+    if (eyeBounds.isInfinite())
+        return false;
+
+    const Cvec3& c = eyeBounds.getCenter();
+    const Cvec3& lo = eyeBounds.getBoxMin();
+    const Cvec3& hi = eyeBounds.getBoxMax();
+    for (int i = 0; i < 6; ++i) {
+        const Cvec4& p = planes_[i];
+        if (p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3] < -eyeBounds.getRadius())
+            return true;
+
+        // the box corner furthest along the plane normal
+        const double d = p[0] * (p[0] > 0 ? hi[0] : lo[0]) + p[1] * (p[1] > 0 ? hi[1] : lo[1]) +
+                         p[2] * (p[2] > 0 ? hi[2] : lo[2]) + p[3];
+        if (d < 0)
+            return true;
+    }
+    return false;
+}
+
+bool Frustum::operator==(const Frustum& other) const {
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            if (planes_[i][j] != other.planes_[i][j])
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include "cvec.h"
+#include "matrix4.h"
+
+// Bounding volume made of an axis aligned box and a sphere. The sphere gives a
+// cheap first test, the box a tighter one. Bounds can be empty (nothing inside)
+// or infinite (unknown extent, never culled).
+class Bounds {
+public:
+    // Empty bounds
+    Bounds() : empty_(true), infinite_(false), boxMin_(0), boxMax_(0), center_(0), radius_(0) {}
+
+    static Bounds infinite() {
+        Bounds b;
+        b.empty_ = false;
+        b.infinite_ = true;
+        return b;
+    }
+
+    // Bounds of `numPoints' points; the sphere is centered on the box
+    static Bounds fromPoints(const Cvec3* points, int numPoints);
+
+    bool isEmpty() const {
+        return empty_;
+    }
+
+    bool isInfinite() const {
+        return infinite_;
+    }
+
+    const Cvec3& getBoxMin() const {
+        return boxMin_;
+    }
+
+    const Cvec3& getBoxMax() const {
+        return boxMax_;
+    }
+
+    const Cvec3& getCenter() const {
+        return center_;
+    }
+
+    double getRadius() const {
+        return radius_;
+    }
+
+    // Grow to also enclose `other'
+    void extend(const Bounds& other);
+
+    // Bounds of the image of this volume under an affine matrix
+    Bounds transformed(const Matrix4& m) const;
+
+private:
+    bool empty_, infinite_;
+    Cvec3 boxMin_, boxMax_;
+    Cvec3 center_;
+    double radius_;
+};
+
+// The six planes of a view frustum, in eye coordinates
+class Frustum {
+public:
+    // Extracts the planes from a projection matrix, such as the one made by
+    // Matrix4::makeProjection
+    explicit Frustum(const Matrix4& projection);
+
+    // True if the bounds, given in eye coordinates, are completely outside.
+    // Empty bounds are always outside and infinite ones never are.
+    bool isOutside(const Bounds& eyeBounds) const;
+
+    // Same planes, e.g., from the same projection matrix
+    bool operator==(const Frustum& other) const;
+
+    bool operator!=(const Frustum& other) const {
+        return !(*this == other);
+    }
+
+private:
+    Cvec4 planes_[6]; // (n, d) with n normalized; inside means dot(n, p) + d >= 0
+};
+
+#endif
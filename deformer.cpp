@@ -0,0 +1,276 @@
+#include <cmath>
+#include <algorithm>
+
+#include "deformer.h"
+
+using namespace std;
+
+static const float TWO_PI_F = float(2 * CS175_PI);
+static const float INV_TWO_PI_F = float(1 / (2 * CS175_PI));
+static const float PI_F = float(CS175_PI);
+static const float HALF_PI_F = float(CS175_PI / 2);
+
+// Reduce an angle to [-pi, pi) in double precision, before it is handed to float code
+static double reduceAngle(double a) {
+    return a - 2 * CS175_PI * floor(a / (2 * CS175_PI) + 0.5);
+}
+
+// Branch free float sine for the batch loops. Reduces to [-pi/2, pi/2] and evaluates
+// a degree 9 Taylor polynomial; the absolute error stays below 4e-6.
+static inline float fastSin(float x) {
+    const float q = x * INV_TWO_PI_F;
+    const float r = x - float(int(q + copysignf(0.5f, q))) * TWO_PI_F;
+    const float a = fabsf(r);
+    const float f = copysignf(min(a, PI_F - a), r);
+    const float f2 = f * f;
+    return f * (1 + f2 * (-1.f / 6 + f2 * (1.f / 120 + f2 * (-1.f / 5040 + f2 * (1.f / 362880)))));
+}
+
+static inline float fastCos(float x) {
+    return fastSin(x + HALF_PI_F);
+}
+
+// floor() that the vectorizer can handle without SSE4.1
+static inline int fastFloor(float x) {
+    const int i = int(x);
+    return i - int(x < float(i));
+}
+
+//----------------------------------
+// PositionArrays
+//----------------------------------
+
+void PositionArrays::resize(int n) {
+    size_ = n;
+    const int padded = (n + BATCH - 1) / BATCH * BATCH;
+    x_.assign(padded, 0.f);
+    y_.assign(padded, 0.f);
+    z_.assign(padded, 0.f);
+}
+
+void PositionArrays::load(const Cvec3* positions, int n) {
+    resize(n);
+    for (int i = 0; i < n; ++i) {
+        x_[i] = float(positions[i][0]);
+        y_[i] = float(positions[i][1]);
+        z_[i] = float(positions[i][2]);
+    }
+}
+
+void PositionArrays::store(Cvec3* positions) const {
+    for (int i = 0; i < size_; ++i)
+        positions[i] = Cvec3(x_[i], y_[i], z_[i]);
+}
+
+void PositionArrays::load(Mesh& mesh) {
+    resize(mesh.getNumVertices());
+    for (int i = 0; i < size_; ++i) {
+        const Cvec3 p = mesh.getVertex(i).getPosition();
+        x_[i] = float(p[0]);
+        y_[i] = float(p[1]);
+        z_[i] = float(p[2]);
+    }
+}
+
+void PositionArrays::store(Mesh& mesh) const {
+    for (int i = 0; i < size_; ++i)
+        mesh.getVertex(i).setPosition(Cvec3(x_[i], y_[i], z_[i]));
+}
+
+//----------------------------------
+// DeformerStack
+//----------------------------------
+
+void DeformerStack::apply(PositionArrays& positions, double time) const {
+    for (size_t i = 0; i < deformers_.size(); ++i)
+        deformers_[i]->apply(positions, time);
+}
+
+void DeformerStack::apply(Mesh& mesh, double time) const {
+    PositionArrays positions;
+    positions.load(mesh);
+    apply(positions, time);
+    positions.store(mesh);
+}
+
+void DeformerStack::apply(Cvec3* positions, int n, double time) const {
+    PositionArrays arrays;
+    arrays.load(positions, n);
+    apply(arrays, time);
+    arrays.store(positions);
+}
+
+//----------------------------------
+// Concrete deformers
+//----------------------------------
+
+// Calls kernel(x, y, z, first) for every batch of BATCH consecutive slots. The kernels
+// take __restrict pointers to the batch, so their fixed length loops vectorize at -O2.
+template<class Kernel>
+static inline void forEachBatch(PositionArrays& positions, Kernel kernel) {
+    float* x = positions.x(), * y = positions.y(), * z = positions.z();
+    for (int b = 0, n = positions.padded(); b < n; b += PositionArrays::BATCH)
+        kernel(x + b, y + b, z + b, b);
+}
+
+void ScaleDeformer::apply(PositionArrays& positions, double time) const {
+    const float sx = scale_[0], sy = scale_[1], sz = scale_[2];
+    const float cx = center_[0], cy = center_[1], cz = center_[2];
+
+    forEachBatch(positions, [=](float* __restrict x, float* __restrict y, float* __restrict z, int) {
+        for (int k = 0; k < PositionArrays::BATCH; ++k) {
+            x[k] = cx + (x[k] - cx) * sx;
+            y[k] = cy + (y[k] - cy) * sy;
+            z[k] = cz + (z[k] - cz) * sz;
+        }
+    });
+}
+
+void TwistDeformer::apply(PositionArrays& positions, double time) const {
+    const float base = float(reduceAngle(rate_ * time)), twist = twist_;
+
+    forEachBatch(positions, [=](float* __restrict x, float* __restrict y, float* __restrict z, int) {
+        for (int k = 0; k < PositionArrays::BATCH; ++k) {
+            const float a = base + twist * y[k];
+            const float c = fastCos(a), s = fastSin(a);
+            const float px = x[k], pz = z[k];
+            x[k] = c * px + s * pz;
+            z[k] = c * pz - s * px;
+        }
+    });
+}
+
+void SineWaveDeformer::apply(PositionArrays& positions, double time) const {
+    const float k2pi = TWO_PI_F / wavelength_;
+    const float kx = propagation_[0] * k2pi, ky = propagation_[1] * k2pi, kz = propagation_[2] * k2pi;
+    const float dx = direction_[0] * amplitude_, dy = direction_[1] * amplitude_, dz = direction_[2] * amplitude_;
+    const float phase = float(reduceAngle(2 * CS175_PI * frequency_ * time));
+
+    forEachBatch(positions, [=](float* __restrict x, float* __restrict y, float* __restrict z, int) {
+        for (int k = 0; k < PositionArrays::BATCH; ++k) {
+            const float s = fastSin(kx * x[k] + ky * y[k] + kz * z[k] - phase);
+            x[k] += dx * s;
+            y[k] += dy * s;
+            z[k] += dz * s;
+        }
+    });
+}
+
+void PulseDeformer::apply(PositionArrays& positions, double time) const {
+    const double phase = frequency_ * time;
+    const float step = float(reduceAngle(phase / 13));
+
+    forEachBatch(positions, [=](float* __restrict x, float* __restrict y, float* __restrict z, int first) {
+        // the phase grows without bound, so reduce it once per batch in double
+        // precision and only add the small per lane increments in float
+        const float base = float(reduceAngle(phase * (0.7 + first / 13.)));
+        for (int k = 0; k < PositionArrays::BATCH; ++k) {
+            const float s = 0.5f * (1.01f + fastSin(base + float(k) * step));
+            x[k] *= s;
+            y[k] *= s;
+            z[k] *= s;
+        }
+    });
+}
+
+// Hash of an integer lattice point to [-1, 1]
+static inline float latticeValue(int ix, int iy, int iz, unsigned int seed) {
+    unsigned int h = unsigned(ix) * 73856093u ^ unsigned(iy) * 19349663u ^ unsigned(iz) * 83492791u ^ seed;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    h ^= h >> 16;
+    return float(h & 0xffff) * (2.f / 65535) - 1;
+}
+
+// Smooth value noise of one batch of points, written to `out'
+static void valueNoise(const float* __restrict x, const float* __restrict y, const float* __restrict z,
+                       unsigned int seed, float* __restrict out) {
+    for (int k = 0; k < PositionArrays::BATCH; ++k) {
+        const int ix = fastFloor(x[k]), iy = fastFloor(y[k]), iz = fastFloor(z[k]);
+        float fx = x[k] - float(ix), fy = y[k] - float(iy), fz = z[k] - float(iz);
+        fx = fx * fx * (3 - 2 * fx);
+        fy = fy * fy * (3 - 2 * fy);
+        fz = fz * fz * (3 - 2 * fz);
+
+        const float v000 = latticeValue(ix, iy, iz, seed), v100 = latticeValue(ix + 1, iy, iz, seed);
+        const float v010 = latticeValue(ix, iy + 1, iz, seed), v110 = latticeValue(ix + 1, iy + 1, iz, seed);
+        const float v001 = latticeValue(ix, iy, iz + 1, seed), v101 = latticeValue(ix + 1, iy, iz + 1, seed);
+        const float v011 = latticeValue(ix, iy + 1, iz + 1, seed), v111 = latticeValue(ix + 1, iy + 1, iz + 1, seed);
+
+        const float x00 = v000 + (v100 - v000) * fx, x10 = v010 + (v110 - v010) * fx;
+        const float x01 = v001 + (v101 - v001) * fx, x11 = v011 + (v111 - v011) * fx;
+        const float y0 = x00 + (x10 - x00) * fy, y1 = x01 + (x11 - x01) * fy;
+        out[k] = y0 + (y1 - y0) * fz;
+    }
+}
+
+void NoiseDeformer::apply(PositionArrays& positions, double time) const {
+    const float f = frequency_, a = amplitude_, t = float(speed_ * time);
+    const unsigned int sx = seed_ * 3 + 1, sy = seed_ * 3 + 2, sz = seed_ * 3 + 3;
+
+    forEachBatch(positions, [=](float* __restrict x, float* __restrict y, float* __restrict z, int) {
+        float px[PositionArrays::BATCH], py[PositionArrays::BATCH], pz[PositionArrays::BATCH];
+        for (int k = 0; k < PositionArrays::BATCH; ++k) {
+            px[k] = x[k] * f + t;
+            py[k] = y[k] * f + t;
+            pz[k] = z[k] * f + t;
+        }
+
+        float n[PositionArrays::BATCH];
+        valueNoise(px, py, pz, sx, n);
+        for (int k = 0; k < PositionArrays::BATCH; ++k)
+            x[k] += a * n[k];
+        valueNoise(px, py, pz, sy, n);
+        for (int k = 0; k < PositionArrays::BATCH; ++k)
+            y[k] += a * n[k];
+        valueNoise(px, py, pz, sz, n);
+        for (int k = 0; k < PositionArrays::BATCH; ++k)
+            z[k] += a * n[k];
+    });
+}
+
+LatticeDeformer::LatticeDeformer(int nx, int ny, int nz, const Cvec3& boxMin, const Cvec3& boxMax)
+        : nx_(max(nx, 2)), ny_(max(ny, 2)), nz_(max(nz, 2)),
+          boxMin_(boxMin[0], boxMin[1], boxMin[2]),
+          displacements_(nx_ * ny_ * nz_, Cvec3f(0)) {
+    const int cells[3] = {nx_ - 1, ny_ - 1, nz_ - 1};
+    for (int i = 0; i < 3; ++i) {
+        const double extent = boxMax[i] - boxMin[i];
+        invCellSize_[i] = extent > CS175_EPS ? float(cells[i] / extent) : 0.f;
+    }
+}
+
+void LatticeDeformer::apply(PositionArrays& positions, double time) const {
+    const Cvec3f* d = &displacements_[0];
+    const int sy = nx_, sz = nx_ * ny_;
+
+    // the control point lookups are gathers, so this one stays mostly scalar
+    forEachBatch(positions, [&](float* __restrict x, float* __restrict y, float* __restrict z, int) {
+        for (int k = 0; k < PositionArrays::BATCH; ++k) {
+            const float s = (x[k] - boxMin_[0]) * invCellSize_[0];
+            const float t = (y[k] - boxMin_[1]) * invCellSize_[1];
+            const float u = (z[k] - boxMin_[2]) * invCellSize_[2];
+            const int i = min(max(fastFloor(s), 0), nx_ - 2);
+            const int j = min(max(fastFloor(t), 0), ny_ - 2);
+            const int l = min(max(fastFloor(u), 0), nz_ - 2);
+            // clamped along with the cell, or vertices outside the box would
+            // extrapolate the displacements of the border cells
+            const float fs = min(max(s - float(i), 0.f), 1.f),
+                    ft = min(max(t - float(j), 0.f), 1.f),
+                    fu = min(max(u - float(l), 0.f), 1.f);
+
+            const Cvec3f* c = d + l * sz + j * sy + i;
+            float delta[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                const float c00 = c[0][axis] + (c[1][axis] - c[0][axis]) * fs;
+                const float c10 = c[sy][axis] + (c[sy + 1][axis] - c[sy][axis]) * fs;
+                const float c01 = c[sz][axis] + (c[sz + 1][axis] - c[sz][axis]) * fs;
+                const float c11 = c[sz + sy][axis] + (c[sz + sy + 1][axis] - c[sz + sy][axis]) * fs;
+                const float c0 = c00 + (c10 - c00) * ft, c1 = c01 + (c11 - c01) * ft;
+                delta[axis] = c0 + (c1 - c0) * fu;
+            }
+            x[k] += delta[0];
+            y[k] += delta[1];
+            z[k] += delta[2];
+        }
+    });
+}
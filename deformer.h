@@ -0,0 +1,178 @@
+#ifndef DEFORMER_H
+#define DEFORMER_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "mesh.h"
+
+// Vertex positions stored as three contiguous float arrays (x, y and z), padded with
+// zeros to a multiple of BATCH. Deformers process them BATCH vertices at a time with
+// straight-line float code, which the compiler turns into SIMD instructions.
+class PositionArrays {
+public:
+    static const int BATCH = 8;
+
+    PositionArrays() : size_(0) {}
+
+    // Number of actual vertices; padded() is the number of slots to process
+    int size() const {
+        return size_;
+    }
+
+    int padded() const {
+        return int(x_.size());
+    }
+
+    void resize(int n);
+
+    float* x() { return x_.data(); }
+
+    float* y() { return y_.data(); }
+
+    float* z() { return z_.data(); }
+
+    const float* x() const { return x_.data(); }
+
+    const float* y() const { return y_.data(); }
+
+    const float* z() const { return z_.data(); }
+
+    void load(const Cvec3* positions, int n);
+
+    void store(Cvec3* positions) const;
+
+    // Read all vertex positions of the mesh / write them back
+    void load(Mesh& mesh);
+
+    void store(Mesh& mesh) const;
+
+private:
+    int size_;
+    std::vector<float> x_, y_, z_;
+};
+
+// A deformation of vertex positions that only depends on the rest position, the
+// vertex index and time. apply() is const and must not keep per-call state, so a
+// deformer (or a stack of them) can be shared between threads and meshes.
+class Deformer {
+public:
+    virtual void apply(PositionArrays& positions, double time) const = 0;
+
+    virtual ~Deformer() {}
+};
+
+// Applies its deformers in the order they were pushed
+class DeformerStack : public Deformer {
+public:
+    DeformerStack& push(std::shared_ptr<Deformer> deformer) {
+        deformers_.push_back(deformer);
+        return *this;
+    }
+
+    bool empty() const {
+        return deformers_.empty();
+    }
+
+    virtual void apply(PositionArrays& positions, double time) const;
+
+    // Convenience wrappers that go through a temporary PositionArrays
+    void apply(Mesh& mesh, double time) const;
+
+    void apply(Cvec3* positions, int n, double time) const;
+
+private:
+    std::vector<std::shared_ptr<Deformer> > deformers_;
+};
+
+//----------------------------------
+// Concrete deformers
+//----------------------------------
+
+// Non-uniform scale about `center'
+class ScaleDeformer : public Deformer {
+    Cvec3f scale_, center_;
+public:
+    ScaleDeformer(const Cvec3& scale, const Cvec3& center = Cvec3(0))
+            : scale_(scale[0], scale[1], scale[2]), center_(center[0], center[1], center[2]) {}
+
+    virtual void apply(PositionArrays& positions, double time) const;
+};
+
+// Rotates each vertex about the y axis by (rate * time + twist * y) radians
+class TwistDeformer : public Deformer {
+    float twist_;
+    double rate_;
+public:
+    TwistDeformer(float twist, double rate = 0) : twist_(twist), rate_(rate) {}
+
+    virtual void apply(PositionArrays& positions, double time) const;
+};
+
+// Travelling wave: displaces along `direction' by
+// amplitude * sin(2 pi (dot(p, propagation) / wavelength - frequency * time))
+class SineWaveDeformer : public Deformer {
+    Cvec3f direction_, propagation_;
+    float amplitude_, wavelength_;
+    double frequency_;
+public:
+    SineWaveDeformer(float amplitude, float wavelength, double frequency,
+                     const Cvec3& direction = Cvec3(0, 1, 0), const Cvec3& propagation = Cvec3(1, 0, 0))
+            : direction_(direction[0], direction[1], direction[2]),
+              propagation_(propagation[0], propagation[1], propagation[2]),
+              amplitude_(amplitude), wavelength_(wavelength), frequency_(frequency) {}
+
+    virtual void apply(PositionArrays& positions, double time) const;
+};
+
+// Scales each vertex about the origin by 0.5 (1.01 + sin(frequency * time * (0.7 + i / 13))),
+// i being the vertex index, so every vertex pulses at its own pace. This is the
+// wobble of the animated cube.
+class PulseDeformer : public Deformer {
+    double frequency_;
+public:
+    PulseDeformer(double frequency) : frequency_(frequency) {}
+
+    virtual void apply(PositionArrays& positions, double time) const;
+};
+
+// Displaces every coordinate by smooth 3D value noise of the position, scrolling
+// with time. Deterministic for a given seed.
+class NoiseDeformer : public Deformer {
+    float amplitude_, frequency_;
+    double speed_;
+    unsigned int seed_;
+public:
+    NoiseDeformer(float amplitude, float frequency, double speed = 0, unsigned int seed = 0)
+            : amplitude_(amplitude), frequency_(frequency), speed_(speed), seed_(seed) {}
+
+    virtual void apply(PositionArrays& positions, double time) const;
+};
+
+// Free form deformation by a regular lattice of nx * ny * nz control points spanning
+// the box [boxMin, boxMax]. Each vertex is displaced by the trilinear interpolation
+// of the displacements of its cell's eight control points. Vertices outside the box
+// are displaced like the nearest point of the box.
+class LatticeDeformer : public Deformer {
+public:
+    LatticeDeformer(int nx, int ny, int nz, const Cvec3& boxMin, const Cvec3& boxMax);
+
+    int getIndex(int i, int j, int k) const {
+        return (k * ny_ + j) * nx_ + i;
+    }
+
+    // Displacement of the control point (i, j, k) from its rest position
+    void setDisplacement(int i, int j, int k, const Cvec3& d) {
+        displacements_[getIndex(i, j, k)] = Cvec3f(d[0], d[1], d[2]);
+    }
+
+    virtual void apply(PositionArrays& positions, double time) const;
+
+private:
+    int nx_, ny_, nz_;
+    Cvec3f boxMin_, invCellSize_;
+    std::vector<Cvec3f> displacements_;
+};
+
+#endif
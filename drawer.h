@@ -4,31 +4,52 @@
 #include <vector>
 
 #include "uniforms.h"
+#include "bounds.h"
 #include "scenegraph.h"
+#include "occlusion.h"
 #include "asstcommon.h"
 
 class Drawer : public SgNodeVisitor {
 protected:
     std::vector<RigTForm> rbtStack_;
     Uniforms& uniforms_;
+    const Frustum* frustum_;
+    const OcclusionBuffer* occlusion_;
+
+    bool isCulled(const Bounds& bounds) const {
+        if (!frustum_ && !occlusion_)
+            return false;
+        const Bounds eyeBounds = bounds.transformed(rigTFormToMatrix(rbtStack_.back()));
+        return (frustum_ && frustum_->isOutside(eyeBounds)) || (occlusion_ && occlusion_->isOccluded(eyeBounds));
+    }
 public:
-    Drawer(const RigTForm& initialRbt, Uniforms& uniforms)
-            : rbtStack_(1, initialRbt), uniforms_(uniforms) {}
+    // If `frustum' is given, subtrees and shapes whose bounds lie outside of it
+    // are skipped, and if `occlusion' is, those it hides. initialRbt must then map
+    // world to eye coordinates.
+    Drawer(const RigTForm& initialRbt, Uniforms& uniforms, const Frustum* frustum = NULL,
+           const OcclusionBuffer* occlusion = NULL)
+            : rbtStack_(1, initialRbt), uniforms_(uniforms), frustum_(frustum), occlusion_(occlusion) {}
 
     virtual bool visit(SgTransformNode& node) {
         rbtStack_.push_back(rbtStack_.back() * node.getRbt());
         return true;
     }
 
+    virtual bool visitChildren(SgTransformNode& node) {
+        return !isCulled(node.getSubtreeBounds());
+    }
+
     virtual bool postVisit(SgTransformNode& node) {
         rbtStack_.pop_back();
         return true;
     }
 
     virtual bool visit(SgShapeNode& shapeNode) {
-        const Matrix4 MVM = rigTFormToMatrix(rbtStack_.back()) * shapeNode.getAffineMatrix();
-        sendModelViewNormalMatrix(uniforms_, MVM, normalMatrix(MVM));
-        shapeNode.draw(uniforms_);
+        if (isCulled(shapeNode.getBounds()))
+            return true;
+        const RigTForm& rbt = rbtStack_.back();
+        const Matrix4 MVM = rigTFormToMatrix(rbt) * shapeNode.getAffineMatrix();
+        shapeNode.draw(uniforms_, MVM, normalMatrix(rbt, shapeNode.getNormalAffineMatrix()));
         return true;
     }
 
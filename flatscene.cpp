@@ -0,0 +1,518 @@
+#include <utility>
+#include <algorithm>
+#include <map>
+
+#include "asstcommon.h"
+#include "flatscene.h"
+
+using namespace std;
+
+const int FlatScene::MIN_TASK_TRANSFORMS;
+const int FlatScene::MIN_BATCH_SHAPES;
+
+static bool sameMatrix(const Matrix4& a, const Matrix4& b) {
+    for (int i = 0; i < 16; ++i) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+FlatScene::FlatScene(shared_ptr<SgTransformNode> root, WorkerPool* pool)
+        : root_(root), pool_(pool), compiledVersion_(0), compiled_(false), compileCount_(0), updatedVersion_(0),
+          changes_(new SgChangeList()), regroup_(false), settledVersion_(0), views_(1) {}
+
+FlatScene::View::View()
+        : compileCount(0), drawnVersion(0), prepared(false), culled(false), frustum(Matrix4()),
+          occlusion(NULL), occlusionVersion(0) {}
+
+void FlatScene::compile() {
+    nodes_.clear();
+    parents_.clear();
+    subtreeEnds_.clear();
+    shapeBegins_.clear();
+    shapeEnds_.clear();
+    shapes_.clear();
+    static_.clear();
+
+    // Iterative preorder walk, so deep hierarchies cannot overflow the call stack.
+    // Each stack entry is a transform node index and the next child to visit.
+    vector<pair<int, int> > stack;
+    nodes_.push_back(root_.get());
+    parents_.push_back(-1);
+    subtreeEnds_.push_back(0);
+    shapeBegins_.push_back(0);
+    shapeEnds_.push_back(0);
+    static_.push_back(root_->isStatic());
+    stack.push_back(make_pair(0, 0));
+
+    while (!stack.empty()) {
+        const int index = stack.back().first;
+        SgTransformNode* node = nodes_[index];
+        if (stack.back().second == node->getNumChildren()) {
+            subtreeEnds_[index] = nodes_.size();
+            shapeEnds_[index] = shapes_.size();
+            stack.pop_back();
+            continue;
+        }
+
+        SgNode* child = node->getChild(stack.back().second++).get();
+        if (SgTransformNode* transform = dynamic_cast<SgTransformNode*>(child)) {
+            stack.push_back(make_pair(int(nodes_.size()), 0));
+            nodes_.push_back(transform);
+            parents_.push_back(index);
+            subtreeEnds_.push_back(0);
+            shapeBegins_.push_back(shapes_.size());
+            shapeEnds_.push_back(0);
+            static_.push_back(static_[index] || transform->isStatic());
+        }
+        else if (SgShapeNode* shape = dynamic_cast<SgShapeNode*>(child)) {
+            const Shape s = {index, shape};
+            shapes_.push_back(s);
+        }
+    }
+
+    indices_.clear();
+    for (int i = 0, n = nodes_.size(); i < n; ++i)
+        indices_[nodes_[i]] = i;
+    for (int i = 0, n = shapes_.size(); i < n; ++i)
+        indices_[shapes_[i].node] = -1 - i;
+
+    locals_.resize(nodes_.size());
+    worlds_.resize(nodes_.size());
+    moved_.resize(nodes_.size());
+    shapeStates_.assign(shapes_.size(), SHAPE_CLEAN);
+    shapeBatches_.assign(shapes_.size(), -1);
+    regroup_ = true;
+    partition();
+    compiledVersion_ = SgTransformNode::getStructureVersion();
+    compiled_ = true;
+    ++compileCount_;    // the views are resized and prepared again
+}
+
+void FlatScene::partition() {
+    spine_.clear();
+    spineShapes_.clear();
+    tasks_.clear();
+
+    // aim for a few tasks per worker, so that uneven subtrees still balance out
+    const int numWorkers = pool_ ? pool_->getNumWorkers() : 1;
+    const int taskSize = max(MIN_TASK_TRANSFORMS, int(nodes_.size()) / (4 * numWorkers));
+
+    // whole subtrees that are small enough become tasks, the nodes above them the spine
+    vector<char> inSpine(nodes_.size(), 0);
+    for (int i = 0, n = nodes_.size(); i < n;) {
+        if (subtreeEnds_[i] - i <= taskSize || numWorkers == 1) {
+            tasks_.push_back(i);
+            i = subtreeEnds_[i];
+        }
+        else {
+            spine_.push_back(i);
+            inSpine[i] = 1;
+            ++i;
+        }
+    }
+
+    shapeLists_.resize(shapes_.size());
+    for (int i = 0, n = shapes_.size(); i < n; ++i) {
+        if (inSpine[shapes_[i].transform]) {
+            spineShapes_.push_back(i);
+            shapeLists_[i] = tasks_.size();
+        }
+    }
+    for (int k = 0, n = tasks_.size(); k < n; ++k)
+        fill(shapeLists_.begin() + shapeBegins_[tasks_[k]], shapeLists_.begin() + shapeEnds_[tasks_[k]], k);
+}
+
+bool FlatScene::isRecompileNeeded() const {
+    if (compiledVersion_ == SgTransformNode::getStructureVersion())
+        return false;   // no hierarchy changed anywhere
+    const vector<SgChangeList::Entry>& entries = changes_->getEntries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if ((entries[i].changes & SgNode::CHANGE_STRUCTURE) && indices_.count(entries[i].node))
+            return true;
+    }
+    return false;
+}
+
+bool FlatScene::updateChanged() {
+    changedTransforms_.clear();
+    const vector<SgChangeList::Entry>& entries = changes_->getEntries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const unordered_map<const SgNode*, int>::const_iterator found = indices_.find(entries[i].node);
+        if (found == indices_.end())
+            continue;   // not in this tree
+        if (found->second >= 0)
+            changedTransforms_.push_back(found->second);
+        else
+            shapeStates_[-1 - found->second] = SHAPE_CHANGED;
+    }
+
+    // the subtrees of the changed transforms, skipping those inside another one
+    sort(changedTransforms_.begin(), changedTransforms_.end());
+    int covered = 0;
+    for (int k = 0, end = 0, n = changedTransforms_.size(); k < n; ++k) {
+        if (changedTransforms_[k] >= end) {
+            end = subtreeEnds_[changedTransforms_[k]];
+            covered += end - changedTransforms_[k];
+        }
+    }
+    if (covered > int(nodes_.size()) / 4)
+        return false;   // the parallel sweep is faster
+
+    for (int k = 0, end = 0, n = changedTransforms_.size(); k < n; ++k) {
+        const int root = changedTransforms_[k];
+        if (root < end)
+            continue;
+        end = subtreeEnds_[root];
+        for (int i = root; i < end; ++i) {
+            locals_[i] = nodes_[i]->getRbt();
+            worlds_[i] = parents_[i] < 0 ? locals_[i] : worlds_[parents_[i]] * locals_[i];
+        }
+        for (int i = shapeBegins_[root]; i < shapeEnds_[root]; ++i) {
+            if (shapeStates_[i] == SHAPE_CLEAN)
+                shapeStates_[i] = SHAPE_MOVED;
+        }
+    }
+    return true;
+}
+
+void FlatScene::update() {
+    const bool all = !compiled_ || isRecompileNeeded();
+    if (all)
+        compile();
+    else if (updatedVersion_ == SgNode::getChangeVersion())
+        return;     // nothing changed since the last update
+    else if (updateChanged()) {
+        changes_->clear();
+        compiledVersion_ = SgTransformNode::getStructureVersion();
+        updatedVersion_ = SgNode::getChangeVersion();
+        return;
+    }
+
+    // parents precede their children, so forward passes compute all world rbts:
+    // first over the spine, then over each task's subtree
+    for (size_t k = 0; k < spine_.size(); ++k)
+        updateTransform(spine_[k], all);
+    for (size_t k = 0; k < spineShapes_.size(); ++k)
+        updateShape(spineShapes_[k]);
+    if (pool_)
+        pool_->run(tasks_.size(), [this, all](int task) { updateSubtree(tasks_[task], all); });
+    else {
+        for (size_t k = 0; k < tasks_.size(); ++k)
+            updateSubtree(tasks_[k], all);
+    }
+    changes_->clear();
+    compiledVersion_ = SgTransformNode::getStructureVersion();
+    updatedVersion_ = SgNode::getChangeVersion();
+}
+
+void FlatScene::updateSubtree(int root, bool all) {
+    for (int i = root, end = subtreeEnds_[root]; i < end; ++i)
+        updateTransform(i, all);
+    for (int i = shapeBegins_[root]; i < shapeEnds_[root]; ++i)
+        updateShape(i);
+}
+
+void FlatScene::updateTransform(int i, bool all) {
+    const int parent = parents_[i];
+    moved_[i] = all || nodes_[i]->getChangeStamp() > updatedVersion_ || (parent >= 0 && moved_[parent]);
+    if (moved_[i]) {
+        locals_[i] = nodes_[i]->getRbt();
+        worlds_[i] = parent < 0 ? locals_[i] : worlds_[parent] * locals_[i];
+    }
+}
+
+void FlatScene::updateShape(int shape) {
+    const Shape& s = shapes_[shape];
+    if (s.node->getChangeStamp() > updatedVersion_)
+        shapeStates_[shape] = SHAPE_CHANGED;
+    else if (moved_[s.transform] && shapeStates_[shape] == SHAPE_CLEAN)
+        shapeStates_[shape] = SHAPE_MOVED;
+}
+
+bool FlatScene::isHidden(const View& view, const Bounds& eyeBounds, const Frustum* frustum) const {
+    return (frustum && frustum->isOutside(eyeBounds)) || (view.occlusion && view.occlusion->isOccluded(eyeBounds));
+}
+
+bool FlatScene::isCulled(const View& view, int transform, const RigTForm& invEyeRbt, const Frustum* frustum) const {
+    if (!frustum && !view.occlusion)
+        return false;
+    const Matrix4 eyeMatrix = rigTFormToMatrix(invEyeRbt * worlds_[transform]);
+    return isHidden(view, nodes_[transform]->getSubtreeBounds().transformed(eyeMatrix), frustum);
+}
+
+void FlatScene::prepareSubtree(View& view, int root, const RigTForm& invEyeRbt, const Frustum* frustum,
+                               CommandList& out) {
+    out.queue.clear();
+    out.immediate.clear();
+    fill(view.drawIndices.begin() + shapeBegins_[root], view.drawIndices.begin() + shapeEnds_[root], -1);
+
+    // mark the transforms in culled subtrees, skipping over each culled range
+    vector<char>& visible = view.visible;
+    const int end = subtreeEnds_[root];
+    if (parents_[root] >= 0 && !visible[parents_[root]]) {
+        fill(visible.begin() + root, visible.begin() + end, 0);
+        return;
+    }
+    for (int i = root; i < end;) {
+        if (isCulled(view, i, invEyeRbt, frustum)) {
+            fill(visible.begin() + i, visible.begin() + subtreeEnds_[i], 0);
+            i = subtreeEnds_[i];
+        }
+        else
+            visible[i++] = 1;
+    }
+
+    for (int i = shapeBegins_[root]; i < shapeEnds_[root]; ++i)
+        prepareShape(view, i, invEyeRbt, frustum, out);
+    out.queue.sort();
+}
+
+void FlatScene::prepareShape(View& view, int shape, const RigTForm& invEyeRbt, const Frustum* frustum,
+                             CommandList& out) {
+    const Shape& s = shapes_[shape];
+    view.drawIndices[shape] = -1;
+    if (!view.visible[s.transform] || shapeBatches_[shape] >= 0)
+        return;
+    const RigTForm eyeRbt = invEyeRbt * worlds_[s.transform];
+    const Matrix4 eyeMatrix = rigTFormToMatrix(eyeRbt);
+    if ((frustum || view.occlusion) && isHidden(view, s.node->getBounds().transformed(eyeMatrix), frustum))
+        return;
+    const Matrix4 MVM = eyeMatrix * s.node->getAffineMatrix();
+    const Matrix4 NMVM = normalMatrix(eyeRbt, s.node->getNormalAffineMatrix());
+    const int draw = out.queue.size();
+    if (s.node->enqueue(out.queue, MVM, NMVM))
+        view.drawIndices[shape] = draw;
+    else {
+        view.drawIndices[shape] = -2 - int(out.immediate.size());
+        const ImmediateDraw d = {shape, MVM, NMVM};
+        out.immediate.push_back(d);
+    }
+}
+
+void FlatScene::invalidate() {
+    for (size_t v = 0; v < views_.size(); ++v)
+        views_[v].prepared = false;
+}
+
+void FlatScene::draw(const RigTForm& invEyeRbt, Uniforms& uniforms, const Frustum* frustum,
+                     const OcclusionBuffer* occlusion, int viewIndex) {
+    if (viewIndex >= int(views_.size()))
+        views_.resize(viewIndex + 1);
+    if (settledVersion_ != updatedVersion_)
+        settle();
+
+    View& view = views_[viewIndex];
+    resizeView(view);
+    const Matrix4 eyeMatrix = rigTFormToMatrix(invEyeRbt);
+    if (!view.prepared || !sameMatrix(eyeMatrix, view.eyeMatrix) || view.culled != (frustum != NULL) ||
+        (frustum && *frustum != view.frustum) || view.occlusion != occlusion ||
+        (occlusion && occlusion->getVersion() != view.occlusionVersion)) {
+        // a new view, or the occluders moved: everything is prepared again
+        fill(view.staleLists.begin(), view.staleLists.end(), 1);
+        view.eyeMatrix = eyeMatrix;
+        view.culled = frustum != NULL;
+        if (frustum)
+            view.frustum = *frustum;
+        view.occlusion = occlusion;
+        if (occlusion)
+            view.occlusionVersion = occlusion->getVersion();
+    }
+    if (view.drawnVersion != updatedVersion_) {
+        patch(view, invEyeRbt, frustum);
+        view.drawnVersion = updatedVersion_;
+    }
+
+    if (regroup_) {
+        // shapes move between the batches and the command lists
+        groupBatches();
+        for (size_t v = 0; v < views_.size(); ++v)
+            fill(views_[v].staleLists.begin(), views_[v].staleLists.end(), 1);
+    }
+    if (find(staleBatches_.begin(), staleBatches_.end(), 1) != staleBatches_.end()) {
+        bakeBatches();
+        for (size_t v = 0; v < views_.size(); ++v) {
+            if (!views_[v].staleLists.empty())
+                views_[v].staleLists.back() = 1;     // the batches are drawn with the spine
+        }
+    }
+
+    if (find(view.staleLists.begin(), view.staleLists.end(), 1) != view.staleLists.end())
+        prepare(view, invEyeRbt, frustum);
+    view.prepared = true;
+
+    // GL thread: replay the command lists
+    for (size_t k = 0; k < view.commandLists.size(); ++k) {
+        const CommandList& list = view.commandLists[k];
+        for (size_t j = 0; j < list.immediate.size(); ++j) {
+            const ImmediateDraw& d = list.immediate[j];
+            shapes_[d.shape].node->draw(uniforms, d.MVM, d.NMVM);
+        }
+    }
+    view.queue.submit(uniforms);
+}
+
+void FlatScene::resizeView(View& view) const {
+    if (view.compileCount == compileCount_)
+        return;
+    view.commandLists.resize(tasks_.size() + 1);
+    view.staleLists.assign(view.commandLists.size(), 1);
+    view.listOffsets.resize(view.commandLists.size());
+    view.drawIndices.assign(shapes_.size(), -1);
+    view.shapeStates.assign(shapes_.size(), SHAPE_CLEAN);
+    view.prepared = false;
+    view.compileCount = compileCount_;
+}
+
+void FlatScene::settle() {
+    for (size_t v = 0; v < views_.size(); ++v)
+        resizeView(views_[v]);
+    for (int i = 0, n = shapes_.size(); i < n; ++i) {
+        const char state = shapeStates_[i];
+        if (state == SHAPE_CLEAN)
+            continue;
+        shapeStates_[i] = SHAPE_CLEAN;
+        if (state == SHAPE_CHANGED && static_[shapes_[i].transform])
+            regroup_ = true;
+        else if (shapeBatches_[i] >= 0)
+            staleBatches_[shapeBatches_[i]] = 1;
+        else {
+            for (size_t v = 0; v < views_.size(); ++v)
+                views_[v].shapeStates[i] = max(views_[v].shapeStates[i], state);
+        }
+    }
+    settledVersion_ = updatedVersion_;
+}
+
+void FlatScene::patch(View& view, const RigTForm& invEyeRbt, const Frustum* frustum) {
+    for (int i = 0, n = shapes_.size(); i < n; ++i) {
+        if (view.shapeStates[i] == SHAPE_CLEAN)
+            continue;
+        const int list = shapeLists_[i];
+        const bool changed = view.shapeStates[i] == SHAPE_CHANGED;
+        view.shapeStates[i] = SHAPE_CLEAN;
+        if (changed || view.staleLists[list]) {
+            view.staleLists[list] = 1;
+            continue;
+        }
+
+        // moved: patchable as long as it neither enters nor leaves the view
+        const Shape& s = shapes_[i];
+        const RigTForm eyeRbt = invEyeRbt * worlds_[s.transform];
+        const Matrix4 eyeMatrix = rigTFormToMatrix(eyeRbt);
+        const bool visible = (!frustum && !view.occlusion) ||
+                             !isHidden(view, s.node->getBounds().transformed(eyeMatrix), frustum);
+        const int draw = view.drawIndices[i];
+        if (visible != (draw != -1)) {
+            view.staleLists[list] = 1;
+            continue;
+        }
+        if (!visible)
+            continue;
+
+        const Matrix4 MVM = eyeMatrix * s.node->getAffineMatrix();
+        const Matrix4 NMVM = normalMatrix(eyeRbt, s.node->getNormalAffineMatrix());
+        CommandList& out = view.commandLists[list];
+        if (draw >= 0) {
+            s.node->requeue(out.queue, draw, MVM, NMVM);
+            s.node->requeue(view.queue, view.listOffsets[list] + draw, MVM, NMVM);
+        }
+        else {
+            out.immediate[-2 - draw].MVM = MVM;
+            out.immediate[-2 - draw].NMVM = NMVM;
+        }
+    }
+}
+
+void FlatScene::prepare(View& view, const RigTForm& invEyeRbt, const Frustum* frustum) {
+    view.visible.resize(nodes_.size());
+
+    // Subtree bounds are computed lazily; bring them all up to date here so that
+    // the tasks below only read them
+    if (frustum || view.occlusion)
+        root_->getSubtreeBounds();
+
+    // the spine, which the tasks' visibility depends on, is always prepared again
+    CommandList& spineList = view.commandLists.back();
+    spineList.queue.clear();
+    spineList.immediate.clear();
+    for (size_t k = 0; k < spine_.size(); ++k) {
+        const int i = spine_[k];
+        view.visible[i] = (parents_[i] < 0 || view.visible[parents_[i]]) && !isCulled(view, i, invEyeRbt, frustum);
+    }
+    for (size_t k = 0; k < spineShapes_.size(); ++k)
+        prepareShape(view, spineShapes_[k], invEyeRbt, frustum, spineList);
+    const Matrix4 eyeMatrix = rigTFormToMatrix(invEyeRbt);
+    const Matrix4 eyeNormalMatrix = normalMatrix(invEyeRbt, Matrix4());
+    for (size_t b = 0; b < batches_.size(); ++b) {
+        StaticBatch& batch = *batches_[b];
+        if ((!frustum && !view.occlusion) || !isHidden(view, batch.getBounds().transformed(eyeMatrix), frustum))
+            spineList.queue.push(eyeMatrix, eyeNormalMatrix, batch.getMaterial(), batch.getGeometry());
+    }
+    spineList.queue.sort();
+
+    vector<int> stale;
+    for (int k = 0, n = tasks_.size(); k < n; ++k) {
+        if (view.staleLists[k])
+            stale.push_back(k);
+    }
+    const auto prepareTask = [&](int i) {
+        prepareSubtree(view, tasks_[stale[i]], invEyeRbt, frustum, view.commandLists[stale[i]]);
+    };
+    if (pool_)
+        pool_->run(stale.size(), prepareTask);
+    else {
+        for (int i = 0, n = stale.size(); i < n; ++i)
+            prepareTask(i);
+    }
+    fill(view.staleLists.begin(), view.staleLists.end(), 0);
+
+    view.queue.clear();
+    for (size_t k = 0; k < view.commandLists.size(); ++k) {
+        view.listOffsets[k] = view.queue.size();
+        view.queue.merge(view.commandLists[k].queue);
+    }
+}
+
+void FlatScene::groupBatches() {
+    // static shapes by material and vertex format, in preorder
+    map<pair<Material*, const VertexFormat*>, vector<int> > groups;
+    for (int i = 0, n = shapes_.size(); i < n; ++i) {
+        if (!static_[shapes_[i].transform])
+            continue;
+        SgGeometryShapeNode* node = dynamic_cast<SgGeometryShapeNode*>(shapes_[i].node);
+        if (node && StaticBatch::canBatch(*node->geometry))
+            groups[make_pair(&node->getDrawMaterial(), &StaticBatch::getVertexFormat(*node->geometry))].push_back(i);
+    }
+
+    batches_.clear();
+    batchShapes_.clear();
+    shapeBatches_.assign(shapes_.size(), -1);
+    for (auto g = groups.begin(); g != groups.end(); ++g) {
+        if (int(g->second.size()) < MIN_BATCH_SHAPES)
+            continue;
+        for (size_t i = 0; i < g->second.size(); ++i)
+            shapeBatches_[g->second[i]] = batches_.size();
+        batches_.push_back(make_shared<StaticBatch>(*g->first.first, *g->first.second));
+        batchShapes_.push_back(g->second);
+    }
+    staleBatches_.assign(batches_.size(), 1);
+    regroup_ = false;
+}
+
+void FlatScene::bakeBatches() {
+    for (size_t b = 0; b < batches_.size(); ++b) {
+        if (!staleBatches_[b])
+            continue;
+        StaticBatch& batch = *batches_[b];
+        batch.clear();
+        for (size_t i = 0; i < batchShapes_[b].size(); ++i) {
+            const Shape& s = shapes_[batchShapes_[b][i]];
+            SgGeometryShapeNode* node = static_cast<SgGeometryShapeNode*>(s.node);
+            batch.add(*node->geometry, rigTFormToMatrix(worlds_[s.transform]) * node->getAffineMatrix());
+        }
+        batch.upload();
+        staleBatches_[b] = 0;
+    }
+}
@@ -0,0 +1,268 @@
+#ifndef FLATSCENE_H
+#define FLATSCENE_H
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <unordered_map>
+
+#include "rigtform.h"
+#include "uniforms.h"
+#include "bounds.h"
+#include "renderqueue.h"
+#include "workerpool.h"
+#include "scenegraph.h"
+#include "staticbatch.h"
+#include "occlusion.h"
+
+// A scene graph compiled into flat arrays, for traversals that touch every node
+// each frame.
+//
+// Transform nodes are stored in preorder, so a node always comes after its parent
+// and its subtree is the contiguous range [i, getSubtreeEnd(i)). World rbts are
+// then computed in one linear pass over the arrays instead of a recursive visit.
+// Shape nodes are listed separately, also in preorder, each with the index of the
+// transform node it hangs under.
+//
+// The arrays are only recompiled when the hierarchy of the tree changes. update()
+// takes the nodes changed since the last update from an SgChangeList, pulls
+// their local rbts, and recomputes the world rbts of their subtrees only. When
+// the changed subtrees make up a large part of the tree, it sweeps over all the
+// nodes instead, picking the changed ones by SgNode::getChangeStamp().
+//
+// draw() retains what it prepares: the sorted command lists, with the model view
+// and normal matrix of every visible shape, are kept and replayed as long as the
+// view stays the same. Shapes under moved transforms only get their matrices
+// patched in place. The command list of a shape is prepared again when the shape
+// itself changed, or moved into or out of the view; all of them when the eye,
+// the frustum or the occluders changed, or the hierarchy was recompiled. A
+// static scene seen from a static eye thus costs no traversal at all, only the
+// GL calls.
+//
+// Shapes under transforms flagged with SgTransformNode::setStatic() are baked into
+// StaticBatches by material and vertex format, when there are at least
+// MIN_BATCH_SHAPES of them, and drawn as one draw call per batch. A batch is baked
+// again when one of its shapes moves, and all are regrouped when one changes.
+//
+// Given a WorkerPool, update() and draw() prepare the frame in parallel. The
+// tree is cut into disjoint subtrees of similar size, whose ancestors (the
+// "spine") are handled first on the calling thread. Each subtree is then a task
+// that computes its world rbts, culls, and builds its own sorted command list of
+// model view and normal matrices. Only the merge of those lists and the GL calls
+// remain on the calling thread.
+class FlatScene {
+public:
+    struct Shape {
+        int transform;        // index of the parent transform node
+        SgShapeNode* node;
+    };
+
+    // `pool', if given, must outlive the FlatScene
+    explicit FlatScene(std::shared_ptr<SgTransformNode> root, WorkerPool* pool = NULL);
+
+    // Recompile if the hierarchy changed, then refresh the local and world rbts
+    // of the changed nodes
+    void update();
+
+    int getNumTransforms() const {
+        return nodes_.size();
+    }
+
+    SgTransformNode* getTransform(int i) const {
+        return nodes_[i];
+    }
+
+    // Index of the parent of transform i, -1 for the root
+    int getParentIndex(int i) const {
+        return parents_[i];
+    }
+
+    // One past the last transform node in the subtree of transform i
+    int getSubtreeEnd(int i) const {
+        return subtreeEnds_[i];
+    }
+
+    const RigTForm& getLocalRbt(int i) const {
+        return locals_[i];
+    }
+
+    // Accumulated rbt from the root down to and including transform i, like
+    // SgTransformNode::getWorldRbt()
+    const RigTForm& getWorldRbt(int i) const {
+        return worlds_[i];
+    }
+
+    const std::vector<Shape>& getShapes() const {
+        return shapes_;
+    }
+
+    // Draw all shapes. Those that support SgShapeNode::enqueue() go through a
+    // RenderQueue and are drawn sorted by GL state, the others immediately
+    // beforehand. update() must have been called since the scene last changed. If
+    // `frustum' is given, subtrees and shapes whose bounds lie outside of it are
+    // skipped, and if `occlusion' is, those it hides; the command lists are then
+    // prepared again whenever its version changes. What the shapes enqueue is
+    // retained, so g_overridingMaterial must not change between calls unless
+    // invalidate() is called.
+    //
+    // Several cameras are drawn from one update() by giving each its own `view'
+    // number, counted from 0: a view retains its own command lists, so each only
+    // culls and submits, and its lists are kept from one frame to the next as
+    // long as its camera stays put.
+    void draw(const RigTForm& invEyeRbt, Uniforms& uniforms, const Frustum* frustum = NULL,
+              const OcclusionBuffer* occlusion = NULL, int view = 0);
+
+    // Make the next draw() of every view prepare all command lists again
+    void invalidate();
+
+    // The queue used by draw() for a view, for its statistics
+    const RenderQueue& getRenderQueue(int view = 0) const {
+        return views_[view].queue;
+    }
+
+private:
+    // Draw of a shape that cannot be queued
+    struct ImmediateDraw {
+        int shape;
+        Matrix4 MVM, NMVM;
+    };
+
+    // Command list built by one task of draw()
+    struct CommandList {
+        RenderQueue queue;
+        std::vector<ImmediateDraw> immediate;
+    };
+
+    // What draw() retains for one camera
+    struct View {
+        View();
+
+        unsigned long compileCount;     // compileCount_ the arrays below were sized for
+        std::vector<CommandList> commandLists;  // one per task, then one for the spine
+        std::vector<char> staleLists;   // per command list, whether to prepare it again
+        std::vector<int> listOffsets;   // per command list, index of its first draw in queue
+
+        // Per shape, its draws in its command list: the index of the first in the
+        // queue, -2 - j for immediate[j], or -1 if it was culled
+        std::vector<int> drawIndices;
+        std::vector<char> shapeStates;  // per shape, a ShapeState set by settle(), cleared by draw()
+        std::vector<char> visible;      // per transform, scratch for draw()
+        unsigned long drawnVersion;     // updatedVersion_ at the last draw()
+
+        // The camera the command lists were prepared for
+        bool prepared;
+        Matrix4 eyeMatrix;
+        bool culled;
+        Frustum frustum;
+        const OcclusionBuffer* occlusion;
+        unsigned long occlusionVersion;
+
+        RenderQueue queue;
+    };
+
+    // What happened to a shape since the last update() or draw() of a view, see
+    // shapeStates_
+    enum ShapeState {
+        SHAPE_CLEAN = 0,
+        SHAPE_MOVED,      // its world rbt changed
+        SHAPE_CHANGED     // the node itself changed, e.g., its geometry or material
+    };
+
+    // Smallest subtree worth a task of its own
+    static const int MIN_TASK_TRANSFORMS = 32;
+
+    // Fewest static shapes worth baking into a batch
+    static const int MIN_BATCH_SHAPES = 2;
+
+    void compile();
+
+    // Split the transforms into spine_ and tasks_
+    void partition();
+
+    // Whether changes_ holds a change to the hierarchy of the compiled tree
+    bool isRecompileNeeded() const;
+
+    // Refresh the subtrees of the transforms in changes_, and the shapes, unless
+    // there are too many; returns false then
+    bool updateChanged();
+
+    // With `all', refresh every node instead of just the changed ones
+    void updateSubtree(int root, bool all);
+
+    void updateTransform(int i, bool all);
+
+    void updateShape(int shape);
+
+    // Fit a view to the arrays of the last compile()
+    void resizeView(View& view) const;
+
+    // Mark the batches the last update() changed as stale, and hand the other
+    // shape states on to every view
+    void settle();
+
+    // Patch the matrices of the moved shapes into the command lists of a view, and
+    // mark the lists of those that cannot be patched as stale
+    void patch(View& view, const RigTForm& invEyeRbt, const Frustum* frustum);
+
+    // Prepare the stale command lists of a view again, then merge all of them
+    // into its queue
+    void prepare(View& view, const RigTForm& invEyeRbt, const Frustum* frustum);
+
+    // Sort the static shapes into batches_
+    void groupBatches();
+
+    // Bake the stale batches from the current world rbts
+    void bakeBatches();
+
+    // Cull the subtree of transform `root' and record its visible shapes
+    void prepareSubtree(View& view, int root, const RigTForm& invEyeRbt, const Frustum* frustum,
+                        CommandList& out);
+
+    void prepareShape(View& view, int shape, const RigTForm& invEyeRbt, const Frustum* frustum,
+                      CommandList& out);
+
+    bool isCulled(const View& view, int transform, const RigTForm& invEyeRbt, const Frustum* frustum) const;
+
+    // Whether bounds in eye coordinates are outside the frustum or occluded
+    bool isHidden(const View& view, const Bounds& eyeBounds, const Frustum* frustum) const;
+
+    std::shared_ptr<SgTransformNode> root_;
+    WorkerPool* pool_;
+    unsigned long compiledVersion_;
+    bool compiled_;
+    unsigned long compileCount_;    // number of compile() calls
+    unsigned long updatedVersion_;  // SgNode::getChangeVersion() at the last update()
+
+    std::vector<SgTransformNode*> nodes_;
+    std::vector<int> parents_, subtreeEnds_;
+    std::vector<int> shapeBegins_, shapeEnds_;  // per transform, range of its subtree in shapes_
+    std::vector<RigTForm> locals_, worlds_;
+    std::vector<Shape> shapes_;
+    std::vector<char> moved_;     // per transform, whether the last update() moved it
+
+    // Nodes changed since the last update(), and the index of each compiled node:
+    // i for transform i, -1 - i for shape i
+    std::unique_ptr<SgChangeList> changes_;
+    std::unordered_map<const SgNode*, int> indices_;
+    std::vector<int> changedTransforms_;  // scratch for updateChanged()
+    std::vector<char> static_;    // per transform, whether it or an ancestor is static
+    std::vector<char> shapeStates_; // per shape, a ShapeState set by update(), cleared by settle()
+
+    std::vector<int> spine_;        // transforms above the tasks, in preorder
+    std::vector<int> spineShapes_;  // shapes directly under spine transforms
+    std::vector<int> tasks_;        // root transform of each task's subtree
+
+    std::vector<int> shapeLists_;   // per shape, the command list it goes into
+
+    std::vector<std::shared_ptr<StaticBatch> > batches_;
+    std::vector<std::vector<int> > batchShapes_;   // per batch, the shapes baked into it
+    std::vector<char> staleBatches_;  // per batch, whether to bake it again
+    std::vector<int> shapeBatches_;   // per shape, its batch or -1
+    bool regroup_;                    // whether to call groupBatches() before drawing
+
+    unsigned long settledVersion_;  // updatedVersion_ at the last settle()
+
+    std::vector<View> views_;
+};
+
+#endif
@@ -23,9 +23,28 @@ const VertexFormat VertexPNTBX::FORMAT = VertexFormat(sizeof(VertexPNTBX))
         .put("aTexCoord", 2, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, x));
 
 
+void FormattedIbo::download(vector<unsigned int>& indices) const {
+    const int indexSize = format_ == GL_UNSIGNED_BYTE ? 1 : format_ == GL_UNSIGNED_SHORT ? 2 : 4;
+    vector<char> bytes(indexSize * length_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *this);
+    if (!bytes.empty())
+        glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, bytes.size(), &bytes[0]);
+
+    indices.resize(length_);
+    for (int i = 0; i < length_; ++i) {
+        if (indexSize == 1)
+            indices[i] = reinterpret_cast<const GLubyte*>(&bytes[0])[i];
+        else if (indexSize == 2)
+            indices[i] = reinterpret_cast<const GLushort*>(&bytes[0])[i];
+        else
+            indices[i] = reinterpret_cast<const GLuint*>(&bytes[0])[i];
+    }
+}
+
+
 BufferObjectGeometry::BufferObjectGeometry()
         : wiringChanged_(true),
-          primitiveType_(GL_TRIANGLES) {}
+          primitiveType_(GL_TRIANGLES), hasBounds_(false) {}
 
 BufferObjectGeometry& BufferObjectGeometry::wire(
         const string& targetAttribName,
@@ -53,6 +72,12 @@ BufferObjectGeometry& BufferObjectGeometry::indexedBy(shared_ptr<FormattedIbo> i
     return *this;
 }
 
+BufferObjectGeometry& BufferObjectGeometry::bounds(const Bounds& b) {
+    bounds_ = b;
+    hasBounds_ = true;
+    return *this;
+}
+
 BufferObjectGeometry& BufferObjectGeometry::primitiveType(GLenum primitiveType) {
     switch (primitiveType) {
         case GL_POINTS:
@@ -80,12 +105,14 @@ const vector<string>& BufferObjectGeometry::getVertexAttribNames() {
 }
 
 void BufferObjectGeometry::draw(int attribIndices[]) {
+    bind(attribIndices);
+    drawBound(attribIndices);
+}
+
+void BufferObjectGeometry::bind(int attribIndices[]) {
     if (wiringChanged_)
         processWiring();
 
-    const unsigned int UNDEFINED_VB_LEN = 0xFFFFFFFF;
-    unsigned int vboLen = UNDEFINED_VB_LEN;
-
     // bind the vertex buffer and set vertex attribute pointers
     for (int i = 0, n = perVbWirings_.size(); i < n; ++i) {
         const PerVbWiring& pvw = perVbWirings_[i];
@@ -93,8 +120,6 @@ void BufferObjectGeometry::draw(int attribIndices[]) {
 
         glBindBuffer(GL_ARRAY_BUFFER, *(pvw.vb));
 
-        vboLen = min(vboLen, (unsigned int) pvw.vb->length());
-
         for (size_t j = 0; j < pvw.vb2GeoIdx.size(); ++j) {
             int loc = attribIndices[pvw.vb2GeoIdx[j].second];
             if (loc >= 0)
@@ -102,13 +127,39 @@ void BufferObjectGeometry::draw(int attribIndices[]) {
         }
     }
 
-    if (isIndexed()) {
+    if (isIndexed())
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *ib_);
+}
+
+void BufferObjectGeometry::drawBound(int attribIndices[]) {
+    if (isIndexed())
         glDrawElements(primitiveType_, ib_->length(), ib_->getIndexFormat(), 0);
+    else if (!perVbWirings_.empty())
+        glDrawArrays(primitiveType_, 0, getUnindexedLength());
+}
+
+void BufferObjectGeometry::drawBoundInstanced(int attribIndices[], int numInstances) {
+    if (isIndexed())
+        glDrawElementsInstanced(primitiveType_, ib_->length(), ib_->getIndexFormat(), 0, numInstances);
+    else if (!perVbWirings_.empty())
+        glDrawArraysInstanced(primitiveType_, 0, getUnindexedLength(), numInstances);
+}
+
+shared_ptr<FormattedVbo> BufferObjectGeometry::getSoleVertexBuffer() const {
+    shared_ptr<FormattedVbo> vb;
+    for (Wiring::const_iterator i = wiring_.begin(), e = wiring_.end(); i != e; ++i) {
+        if (i->first != i->second.second || (vb && vb != i->second.first))
+            return shared_ptr<FormattedVbo>();
+        vb = i->second.first;
     }
-    else if (vboLen != UNDEFINED_VB_LEN) {
-        glDrawArrays(primitiveType_, 0, vboLen);
-    }
+    return vb;
+}
+
+int BufferObjectGeometry::getUnindexedLength() const {
+    int length = perVbWirings_[0].vb->length();
+    for (int i = 1, n = perVbWirings_.size(); i < n; ++i)
+        length = min(length, perVbWirings_[i].vb->length());
+    return length;
 }
 
 void BufferObjectGeometry::processWiring() {
@@ -10,7 +10,10 @@
 #include <memory>
 
 #include "cvec.h"
+#include "matrix4.h"
+#include "bounds.h"
 #include "glsupport.h"
+#include "uniforms.h"
 #include "geometrymaker.h"
 
 // An abstract class that encapsulates geometry data that provides vertex attributes and
@@ -26,6 +29,35 @@ public:
     // not used. The caller is responsible for enable/disable vertex attribute arrays.
     virtual void draw(int attribIndices[]) = 0;
 
+    // Split form of draw(), for drawing the same geometry several times in a row:
+    // bind() sets up the vertex streams once, drawBound() only issues the draw call.
+    // The defaults leave everything to draw().
+    virtual void bind(int attribIndices[]) {}
+
+    virtual void drawBound(int attribIndices[]) { draw(attribIndices); }
+
+    // Draw `numInstances' instances after bind(), with the per instance attributes
+    // already set up by the caller. Only supported if isInstanceable() is true.
+    virtual bool isInstanceable() const { return false; }
+
+    virtual void drawBoundInstanced(int attribIndices[], int numInstances) {
+        throw std::runtime_error("Geometry::drawBoundInstanced: geometry does not support instancing");
+    }
+
+    // Return uniforms owned by the geometry itself, such as lookup tables read by a
+    // vertex shader that generates the vertices. Material::draw searches them after
+    // its own uniforms. NULL if the geometry has none.
+    virtual const Uniforms* getUniforms() const { return NULL; }
+
+    // Return the transform from the stored vertex positions to model space, for
+    // geometries with quantized positions (see packedgeometry.h). Whoever computes
+    // the model view matrix folds it in. NULL if positions are stored as is.
+    virtual const Matrix4* getPositionDecode() const { return NULL; }
+
+    // Return the bounds of the vertex positions as stored, i.e., before
+    // getPositionDecode(). NULL if unknown, in which case it is never culled.
+    virtual const Bounds* getBounds() const { return NULL; }
+
     virtual ~Geometry() {}
 };
 
@@ -156,6 +188,27 @@ public:
         checkGlErrors();
 #endif
     }
+
+    // Upload `length' vertices of raw bytes laid out as described by the format
+    void uploadBytes(const void* vertices, int length, bool dynamicUsage = false) {
+        glBindBuffer(GL_ARRAY_BUFFER, *this);
+        length_ = length;
+        const int size = format_.getVertexSize() * length;
+        glBufferData(GL_ARRAY_BUFFER, size, vertices, dynamicUsage ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+#ifndef NDEBUG
+        checkGlErrors();
+#endif
+    }
+
+    // Read the vertices back from GL, as raw bytes laid out as described by the
+    // format. Stalls until the GPU is done with the buffer, so keep this out of
+    // the per frame path.
+    void download(std::vector<char>& vertices) const {
+        vertices.resize(format_.getVertexSize() * length_);
+        glBindBuffer(GL_ARRAY_BUFFER, *this);
+        if (!vertices.empty())
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size(), &vertices[0]);
+    }
 };
 
 // Light wrapper for a GL buffer object storing indices, together with format for its
@@ -198,6 +251,9 @@ public:
 #endif
     }
 
+    // Read the indices back from GL, whatever their format. Stalls like
+    // FormattedVbo::download().
+    void download(std::vector<unsigned int>& indices) const;
 };
 
 // A flexible light weight Geometry implementation allowing drawing using multiple vertex buffers,
@@ -240,11 +296,25 @@ public:
     // Anything you can pass to glDrawArrays is fair game
     BufferObjectGeometry& primitiveType(GLenum primitiveType);
 
+    // Set the bounds returned by getBounds(). The Simple* geometries below do this
+    // on every upload; others must do it themselves if they want to be culled.
+    BufferObjectGeometry& bounds(const Bounds& b);
+
     // Return if we are in indexed mode
     bool isIndexed() const {
         return ib_ ? true : false;
     }
 
+    // The index buffer, NULL if not indexed
+    const std::shared_ptr<FormattedIbo>& getIndexBuffer() const {
+        return ib_;
+    }
+
+    // The vertex buffer that all attributes are wired from under their own names,
+    // as done by wire(source). NULL if they come from several buffers or are
+    // renamed.
+    std::shared_ptr<FormattedVbo> getSoleVertexBuffer() const;
+
     // Return the primitive types we are drawing using. Default is GL_TRIANGLES
     GLenum getPrimitiveType() const {
         return primitiveType_;
@@ -255,10 +325,26 @@ public:
 
     virtual void draw(int attribIndices[]);
 
+    virtual void bind(int attribIndices[]);
+
+    virtual void drawBound(int attribIndices[]);
+
+    virtual bool isInstanceable() const {
+        return true;
+    }
+
+    virtual void drawBoundInstanced(int attribIndices[], int numInstances);
+
+    virtual const Bounds* getBounds() const {
+        return hasBounds_ ? &bounds_ : NULL;
+    }
+
 private:
     typedef std::map<std::string, std::pair<std::shared_ptr<FormattedVbo>, std::string> > Wiring;
 
     GLenum primitiveType_;
+    bool hasBounds_;
+    Bounds bounds_;
     bool wiringChanged_;
     Wiring wiring_;
     std::shared_ptr<FormattedIbo> ib_;
@@ -279,6 +365,9 @@ private:
     std::vector<PerVbWiring> perVbWirings_;
     std::vector<std::string> vertexAttribNames_;
 
+    // Number of vertices to draw when not indexed, the length of the shortest vbo
+    int getUnindexedLength() const;
+
     // Setups up perVbWiring_ and vertexAttribNames_. Gets called whenever wiringChanged_ is true
     // and we need to draw or return list of vertex attributes.
     void processWiring();
@@ -406,6 +495,20 @@ struct VertexPNTBX : public VertexPNX {
     }
 };
 
+// Position of a vertex as the vertex shader sees it, used to compute bounds.
+// Other vertex types used with the Simple* geometries need an overload.
+inline Cvec3 vertexPosition(const VertexPN& v) {
+    return Cvec3(v.p[0], v.p[1], v.p[2]);
+}
+
+template<typename Vertex>
+Bounds computeBounds(const Vertex* vertices, int numVertices) {
+    std::vector<Cvec3> positions(numVertices);
+    for (int i = 0; i < numVertices; ++i)
+        positions[i] = vertexPosition(vertices[i]);
+    return Bounds::fromPoints(numVertices ? &positions[0] : NULL, numVertices);
+}
+
 // Simple unindex geometry implementation based on BufferObjectGeometry
 template<typename Vertex>
 class SimpleUnindexedGeometry : public BufferObjectGeometry {
@@ -425,6 +528,7 @@ public:
 
     void upload(const Vertex* vertices, int numVertices) {
         vbo->upload(vertices, numVertices, true);
+        bounds(computeBounds(vertices, numVertices));
     }
 };
 
@@ -453,6 +557,7 @@ public:
     void upload(const Vertex* vertices, const Index* indices, int numVertices, int numIndices) {
         vbo->upload(vertices, numVertices, true);
         ibo->upload(indices, numIndices, true);
+        bounds(computeBounds(vertices, numVertices));
     }
 
 private:
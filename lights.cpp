@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+
+#include "asstcommon.h"
+#include "lights.h"
+
+using namespace std;
+
+const int LightManager::TILES_X;
+const int LightManager::TILES_Y;
+const int LightManager::SLICES;
+const int LightManager::NUM_CLUSTERS;
+
+LightManager::LightManager()
+        : logNear_(0), sliceScale_(0), offsets_(NUM_CLUSTERS + 1, 0) {
+    // buffer textures need GL 3.1
+    if (!g_Gl2Compatible) {
+        lightTexture_.reset(new BufferTexture(GL_RGBA32F));
+        clusterTexture_.reset(new BufferTexture(GL_RG32F));
+        indexTexture_.reset(new BufferTexture(GL_R32F));
+    }
+}
+
+int LightManager::addLight(shared_ptr<SgTransformNode> node, const Cvec3& color, double radius) {
+    Light light;
+    light.node = std::move(node);
+    light.color = Cvec3f(color[0], color[1], color[2]);
+    light.radius = float(radius);
+    lights_.push_back(light);
+    return lights_.size() - 1;
+}
+
+void LightManager::removeAllLights() {
+    lights_.clear();
+}
+
+int LightManager::getSlice(double distance) const {
+    const int s = int(floor((log(distance) - logNear_) * sliceScale_));
+    return min(max(s, 0), SLICES - 1);
+}
+
+bool LightManager::getClusterRange(const Cvec3& p, double radius, const Matrix4& projection,
+                                   double nearDistance, double farDistance, ClusterRange& range) const {
+    const double closest = -p[2] - radius, farthest = -p[2] + radius;
+    if (farthest < nearDistance || closest > farDistance)
+        return false;
+    range.s0 = getSlice(max(closest, nearDistance));
+    range.s1 = getSlice(min(farthest, farDistance));
+
+    range.x0 = range.y0 = 0;
+    range.x1 = TILES_X - 1;
+    range.y1 = TILES_Y - 1;
+    if (closest <= nearDistance)
+        return true;    // the sphere reaches the near plane: its image is unbounded
+
+    // screen rectangle of the box around the sphere, which lies in front of the eye
+    double minX = 1, maxX = -1, minY = 1, maxY = -1;
+    for (int i = 0; i < 8; ++i) {
+        const Cvec4 c = projection * Cvec4(p[0] + (i & 1 ? radius : -radius), p[1] + (i & 2 ? radius : -radius),
+                                           p[2] + (i & 4 ? radius : -radius), 1);
+        minX = min(minX, c[0] / c[3]);
+        maxX = max(maxX, c[0] / c[3]);
+        minY = min(minY, c[1] / c[3]);
+        maxY = max(maxY, c[1] / c[3]);
+    }
+    if (maxX < -1 || minX > 1 || maxY < -1 || minY > 1)
+        return false;
+    range.x0 = max(0, int(floor((minX * 0.5 + 0.5) * TILES_X)));
+    range.x1 = min(TILES_X - 1, int(floor((maxX * 0.5 + 0.5) * TILES_X)));
+    range.y0 = max(0, int(floor((minY * 0.5 + 0.5) * TILES_Y)));
+    range.y1 = min(TILES_Y - 1, int(floor((maxY * 0.5 + 0.5) * TILES_Y)));
+    return true;
+}
+
+void LightManager::update(const RigTForm& invEyeRbt, const Matrix4& projection, double zNear, double zFar) {
+    const int numLights = lights_.size();
+    eyePositions_.resize(numLights);
+    for (int i = 0; i < numLights; ++i)
+        eyePositions_[i] = Cvec3(invEyeRbt * Cvec4(lights_[i].node->getWorldRbt().getTranslation(), 1));
+    if (g_Gl2Compatible)
+        return;     // the GLSL 1.0 shaders only see the first two lights, see put()
+
+    const double nearDistance = -zNear, farDistance = -zFar;
+    logNear_ = log(nearDistance);
+    sliceScale_ = SLICES / log(farDistance / nearDistance);
+
+    lightData_.resize(8 * max(numLights, 1));
+    ranges_.resize(numLights);
+    fill(offsets_.begin(), offsets_.end(), 0);
+
+    // count the lights of each cluster, in offsets_[c + 1]
+    for (int i = 0; i < numLights; ++i) {
+        const Light& light = lights_[i];
+        const Cvec3& p = eyePositions_[i];
+        float* data = &lightData_[8 * i];
+        data[0] = float(p[0]);
+        data[1] = float(p[1]);
+        data[2] = float(p[2]);
+        data[3] = light.radius;
+        data[4] = light.color[0];
+        data[5] = light.color[1];
+        data[6] = light.color[2];
+        data[7] = 0;
+
+        ClusterRange& r = ranges_[i];
+        if (light.radius <= 0) {
+            const ClusterRange all = {0, TILES_X - 1, 0, TILES_Y - 1, 0, SLICES - 1};
+            r = all;
+        }
+        else if (!getClusterRange(p, light.radius, projection, nearDistance, farDistance, r)) {
+            r.s0 = 0;
+            r.s1 = -1;  // empty
+        }
+        for (int s = r.s0; s <= r.s1; ++s) {
+            for (int y = r.y0; y <= r.y1; ++y) {
+                int* counts = &offsets_[(s * TILES_Y + y) * TILES_X + 1];
+                for (int x = r.x0; x <= r.x1; ++x)
+                    ++counts[x];
+            }
+        }
+    }
+
+    // then the start of each cluster's list, and the lists themselves
+    clusterData_.resize(2 * NUM_CLUSTERS);
+    for (int c = 0; c < NUM_CLUSTERS; ++c) {
+        clusterData_[2 * c] = float(offsets_[c]);
+        clusterData_[2 * c + 1] = float(offsets_[c + 1]);
+        offsets_[c + 1] += offsets_[c];
+    }
+    indexData_.resize(max(offsets_[NUM_CLUSTERS], 1));
+    vector<int> next(offsets_.begin(), offsets_.end() - 1);
+    for (int i = 0; i < numLights; ++i) {
+        const ClusterRange& r = ranges_[i];
+        for (int s = r.s0; s <= r.s1; ++s) {
+            for (int y = r.y0; y <= r.y1; ++y) {
+                int* cluster = &next[(s * TILES_Y + y) * TILES_X];
+                for (int x = r.x0; x <= r.x1; ++x)
+                    indexData_[cluster[x]++] = float(i);
+            }
+        }
+    }
+
+    lightTexture_->upload(&lightData_[0], lightData_.size() * sizeof(float));
+    clusterTexture_->upload(&clusterData_[0], clusterData_.size() * sizeof(float));
+    indexTexture_->upload(&indexData_[0], indexData_.size() * sizeof(float));
+}
+
+void LightManager::put(Uniforms& uniforms, int viewportX, int viewportY, int viewportWidth,
+                       int viewportHeight) const {
+    const Cvec3 none(0);
+    uniforms.put("uLight", eyePositions_.size() > 0 ? eyePositions_[0] : none);
+    uniforms.put("uLight2", eyePositions_.size() > 1 ? eyePositions_[1] : none);
+    if (g_Gl2Compatible)
+        return;
+
+    uniforms.put("uLights", lightTexture_);
+    uniforms.put("uClusters", clusterTexture_);
+    uniforms.put("uLightIndices", indexTexture_);
+    uniforms.put("uClusterViewport", Cvec4f(viewportX, viewportY, viewportWidth, viewportHeight));
+    uniforms.put("uClusterGrid", Cvec<int, 3>(TILES_X, TILES_Y, SLICES));
+    uniforms.put("uClusterDepth", Cvec2f(float(logNear_), float(sliceScale_)));
+}
@@ -0,0 +1,95 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "rigtform.h"
+#include "texture.h"
+#include "uniforms.h"
+#include "scenegraph.h"
+
+// Point lights of a scene graph for clustered forward shading.
+//
+// Each light sits at the origin of a transform node and has a color and a
+// radius, at which its contribution has faded to nothing. A radius of 0 makes it
+// light everything, like the two fixed lights the shaders used to have.
+//
+// update() splits the view frustum of a camera into TILES_X x TILES_Y screen
+// tiles and SLICES depth slices, spaced exponentially between the near and far
+// planes, and lists in every such cluster the lights whose sphere reaches into
+// it. The lists go to the fragment shaders through buffer textures (see
+// shaders/diffuse-gl3.fshader), so each fragment only loops over the lights of
+// its own cluster, and its cost follows the local light density rather than
+// the total number of lights.
+class LightManager {
+public:
+    static const int TILES_X = 16;
+    static const int TILES_Y = 16;
+    static const int SLICES = 16;
+    static const int NUM_CLUSTERS = TILES_X * TILES_Y * SLICES;
+
+    LightManager();
+
+    // Returns the index of the light. The node must be in the tree whose root
+    // world rbts are relative to.
+    int addLight(std::shared_ptr<SgTransformNode> node, const Cvec3& color, double radius = 0);
+
+    void removeAllLights();
+
+    int getNumLights() const {
+        return lights_.size();
+    }
+
+    // Bin the lights into the clusters of a camera, and upload them. zNear and
+    // zFar are the clip planes as given to Matrix4::makeProjection, i.e.,
+    // negative. Must be called on the GL thread. With g_Gl2Compatible, only the
+    // eye positions of the lights are computed.
+    void update(const RigTForm& invEyeRbt, const Matrix4& projection, double zNear, double zFar);
+
+    // Send the uniforms of the last update() for drawing into a viewport, given
+    // in window pixels: the cluster tables, and for the GLSL 1.0 shaders, which
+    // cannot read them, the first two lights as uLight and uLight2. With
+    // g_Gl2Compatible only the latter are sent.
+    void put(Uniforms& uniforms, int viewportX, int viewportY, int viewportWidth, int viewportHeight) const;
+
+    // Number of lights listed in cluster (x, y, slice) by the last update()
+    int getClusterSize(int x, int y, int slice) const {
+        const int c = (slice * TILES_Y + y) * TILES_X + x;
+        return offsets_[c + 1] - offsets_[c];
+    }
+
+private:
+    struct Light {
+        std::shared_ptr<SgTransformNode> node;
+        Cvec3f color;
+        float radius;
+    };
+
+    // Clusters a light reaches, as inclusive ranges
+    struct ClusterRange {
+        int x0, x1, y0, y1, s0, s1;
+    };
+
+    std::vector<Light> lights_;
+    double logNear_, sliceScale_;   // slice of eye distance d: (log(d) - logNear_) * sliceScale_
+
+    // Per light, its eye position and radius, then its color; per cluster, the
+    // start of its light indices and their count
+    std::vector<float> lightData_, clusterData_, indexData_;
+    std::vector<Cvec3> eyePositions_;
+    std::vector<ClusterRange> ranges_;
+    std::vector<int> offsets_;  // per cluster, start of its lights in indexData_; one more at the end
+
+    std::shared_ptr<BufferTexture> lightTexture_, clusterTexture_, indexTexture_;
+
+    int getSlice(double distance) const;
+
+    // False if the light reaches no cluster
+    bool getClusterRange(const Cvec3& eyePosition, double radius, const Matrix4& projection,
+                         double nearDistance, double farDistance, ClusterRange& range) const;
+};
+
+#endif
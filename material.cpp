@@ -124,7 +124,25 @@ protected:
 };
 
 Material::Material(const string& vsFilename, const string& fsFilename)
-        : programDesc_(GlProgramLibrary::getSingleton().getProgramDesc(vsFilename, fsFilename)) {}
+        : programDesc_(GlProgramLibrary::getSingleton().getProgramDesc(vsFilename, fsFilename)),
+          fsFilename_(fsFilename), boundProgramDesc_(programDesc_), materialTextureUnits_(0), boundGeometry_(NULL) {}
+
+void Material::enableInstancing(const string& instancedVsFilename) {
+    instancedProgramDesc_ = GlProgramLibrary::getSingleton().getProgramDesc(instancedVsFilename, fsFilename_);
+}
+
+GLuint Material::getProgram(bool instanced) const {
+    return (instanced ? instancedProgramDesc_ : programDesc_)->program;
+}
+
+const Texture* Material::getFirstTexture() const {
+    for (Uniforms::ValueMap::const_iterator i = uniforms_.valueMap.begin(); i != uniforms_.valueMap.end(); ++i) {
+        const shared_ptr<Texture>* tex = i->second.get() ? i->second.get()->getTextures() : NULL;
+        if (tex)
+            return tex[0].get();
+    }
+    return NULL;
+}
 
 static const char* getGlConstantName(GLenum c) {
     struct ValueNamePair {
@@ -158,6 +176,7 @@ static const char* getGlConstantName(GLenum c) {
             {GL_SAMPLER_CUBE,      "GL_SAMPLER_CUBE"},
             {GL_SAMPLER_1D_SHADOW, "GL_SAMPLER_1D_SHADOW"},
             {GL_SAMPLER_2D_SHADOW, "GL_SAMPLER_2D_SHADOW"},
+            {GL_SAMPLER_BUFFER,    "GL_SAMPLER_BUFFER"},
     };
 
     for (int i = 0, n = sizeof(valueNamePairs) / sizeof(valueNamePairs[0]); i < n; ++i) {
@@ -167,7 +186,11 @@ static const char* getGlConstantName(GLenum c) {
     return "Unkonwn";
 }
 
-void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
+// Program currently in use, so that consecutive draws with the same program do
+// not call glUseProgram again
+static GLuint g_currentProgram = 0;
+
+static GLint getMaxTextureImageUnits() {
     static GLint maxTextureImageUnits = 0;
 
     // Initialize maxTextureImageUnits if this is called for the first time
@@ -175,20 +198,64 @@ void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
         glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &maxTextureImageUnits);
         assert(maxTextureImageUnits > 0); // GL spec says this has to be at least 2
     }
+    return maxTextureImageUnits;
+}
 
-    glUseProgram(programDesc_->program);
+void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
+    bind();
+    bindGeometry(geometry);
+    drawBound(extraUniforms);
+    unbindGeometry();
+}
+
+void Material::bind(bool instanced) {
+    if (instanced && !instancedProgramDesc_)
+        throw runtime_error("Material::bind: instancing was not enabled for this material");
+    boundProgramDesc_ = instanced ? instancedProgramDesc_ : programDesc_;
+
+    if (g_currentProgram != boundProgramDesc_->program) {
+        glUseProgram(boundProgramDesc_->program);
+        g_currentProgram = boundProgramDesc_->program;
+    }
 
     renderStates_.apply();  // transit to current states
 
-    // Step 1:
-    // set the uniforms and bind the textures
-    int textureUnit = 0;
-    for (int i = 0, n = programDesc_->uniforms.size(); i < n; ++i) {
-        const GlProgramDesc::UniformDesc& ud = programDesc_->uniforms[i];
+    const Uniforms* uniformsList[] = {&uniforms_};
+    materialTextureUnits_ = sendUniforms(uniformsList, 1, 0, false, 0);
+}
+
+void Material::drawBound(const Uniforms& extraUniforms) {
+    sendDrawUniforms(extraUniforms);
+    boundGeometry_->drawBound(boundAttribs_.empty() ? NULL : &boundAttribs_[0]);
+}
+
+void Material::drawBoundInstanced(int numInstances, const Uniforms& extraUniforms) {
+    sendDrawUniforms(extraUniforms);
+    boundGeometry_->drawBoundInstanced(boundAttribs_.empty() ? NULL : &boundAttribs_[0], numInstances);
+}
+
+void Material::sendDrawUniforms(const Uniforms& extraUniforms) {
+    assert(boundGeometry_ != NULL);
+
+    // Uniforms are looked up in the material, then in the geometry (if it has any),
+    // then in the extra uniforms. The material's own were sent by bind().
+    const Uniforms* uniformsList[] = {&uniforms_, boundGeometry_->getUniforms(), &extraUniforms};
+    const int numUniformsList = sizeof(uniformsList) / sizeof(uniformsList[0]);
+    sendUniforms(uniformsList, numUniformsList, 1, true, materialTextureUnits_);
+}
+
+int Material::sendUniforms(const Uniforms* const uniformsList[], int numUniformsList, int firstSent,
+                           bool requireAll, int textureUnit) {
+    const GLint maxTextureImageUnits = getMaxTextureImageUnits();
+
+    for (int i = 0, n = boundProgramDesc_->uniforms.size(); i < n; ++i) {
+        const GlProgramDesc::UniformDesc& ud = boundProgramDesc_->uniforms[i];
 
-        const Uniforms* uniformsList[] = {&uniforms_, &extraUniforms};
         int j = 0;
-        for (; j < 2; ++j) {
+        for (; j < numUniformsList; ++j) {
+            if (uniformsList[j] == NULL)
+                continue;
+
             const Uniforms::Value* u = uniformsList[j]->get(ud.name);
 
             // if the name looks like blah[0], and the uniform is not found, we also try stripping the '[0]'
@@ -196,13 +263,16 @@ void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
                 u = uniformsList[j]->get(ud.name.substr(0, ud.name.length() - 3));
 
             if (u) {
+                if (j < firstSent)
+                    break;
                 if (u->type == ud.type && u->size >= ud.size) {
                     switch (u->type) {
                         case GL_SAMPLER_1D:
                         case GL_SAMPLER_2D:
                         case GL_SAMPLER_CUBE:
                         case GL_SAMPLER_1D_SHADOW:
-                        case GL_SAMPLER_2D_SHADOW: {
+                        case GL_SAMPLER_2D_SHADOW:
+                        case GL_SAMPLER_BUFFER: {
                             const shared_ptr<Texture>* tex = u->getTextures();
 
                             // If this assert hits, the Uniform::Value is incorrectly implemented
@@ -240,58 +310,74 @@ void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
                 break;
             }
         }
-        if (j == 2) {
+        if (j == numUniformsList && requireAll) {
             stringstream s;
             s << "Uniform variable " << ud.name << ": used in the shader codes, but not supplied. Type = "
               << getGlConstantName(ud.type) << ", Size = " << ud.size;
             throw runtime_error(s.str());
         }
     }
+    return textureUnit;
+}
 
-    // Step 2:
+void Material::bindGeometry(Geometry& geometry, const FormattedVbo* instances) {
     // see what attribs are provided by the geometry
     const vector<string>& geoAttribNames = geometry.getVertexAttribNames();
-
-    const static int MAX_ATTRIB = 64;
-    int attribIndices[MAX_ATTRIB];
     const size_t numAttribs = geoAttribNames.size();
-
-    if (numAttribs > MAX_ATTRIB) {
-        throw runtime_error(
-                string("Number of attributes contained in geometry is greater than maximally supported number of attributes. Consider increasing MAX_ATTRIB."));
-    }
-
-    for (size_t i = 0; i < numAttribs; ++i) {
-        attribIndices[i] = -1;
-    }
+    boundAttribs_.assign(numAttribs, -1);
+    boundInstanceAttribs_.clear();
 
     // simple and stupid O(n^2) wiring, should use a hashtable to reduce to O(n)
-    for (int i = 0, n = programDesc_->attribs.size(); i < n; ++i) {
-        const GlProgramDesc::AttribDesc& ad = programDesc_->attribs[i];
+    for (int i = 0, n = boundProgramDesc_->attribs.size(); i < n; ++i) {
+        const GlProgramDesc::AttribDesc& ad = boundProgramDesc_->attribs[i];
 
         size_t j = 0;
         for (; j < numAttribs; ++j) {
             if (geoAttribNames[j] == ad.name) {
-                attribIndices[j] = ad.location;
+                boundAttribs_[j] = ad.location;
                 break;
             }
         }
         if (j == numAttribs) {
-            throw runtime_error(string("Vertex attribute ") + ad.name
-                                + ": used in the shader codes, but not supplied.");
+            // not in the geometry, try the per instance attributes
+            const int k = instances ? instances->getVertexFormat().getAttribIndexForName(ad.name) : -1;
+            if (k < 0) {
+                throw runtime_error(string("Vertex attribute ") + ad.name
+                                    + ": used in the shader codes, but not supplied.");
+            }
+            boundInstanceAttribs_.push_back(make_pair(k, ad.location));
         }
     }
 
     for (size_t i = 0; i < numAttribs; ++i) {
-        if (attribIndices[i] >= 0)
-            glEnableVertexAttribArray(attribIndices[i]);
+        if (boundAttribs_[i] >= 0)
+            glEnableVertexAttribArray(boundAttribs_[i]);
     }
 
-    // Now let the geometry draw its self
-    geometry.draw(attribIndices);
+    geometry.bind(boundAttribs_.empty() ? NULL : &boundAttribs_[0]);
+    boundGeometry_ = &geometry;
 
-    for (size_t i = 0; i < numAttribs; ++i) {
-        if (attribIndices[i] >= 0)
-            glDisableVertexAttribArray(attribIndices[i]);
+    if (!boundInstanceAttribs_.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, *instances);
+        for (size_t i = 0; i < boundInstanceAttribs_.size(); ++i) {
+            const int location = boundInstanceAttribs_[i].second;
+            glEnableVertexAttribArray(location);
+            instances->getVertexFormat().setGlVertexAttribPointer(boundInstanceAttribs_[i].first, location);
+            glVertexAttribDivisor(location, 1);
+        }
+    }
+}
+
+void Material::unbindGeometry() {
+    for (size_t i = 0; i < boundAttribs_.size(); ++i) {
+        if (boundAttribs_[i] >= 0)
+            glDisableVertexAttribArray(boundAttribs_[i]);
+    }
+    for (size_t i = 0; i < boundInstanceAttribs_.size(); ++i) {
+        glVertexAttribDivisor(boundInstanceAttribs_[i].second, 0);
+        glDisableVertexAttribArray(boundInstanceAttribs_[i].second);
     }
+    boundAttribs_.clear();
+    boundInstanceAttribs_.clear();
+    boundGeometry_ = NULL;
 }
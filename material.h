@@ -23,6 +23,41 @@ public:
 
     void draw(Geometry& geometry, const Uniforms& extraUniforms);
 
+    // Also build a program from `instancedVsFilename' and the fragment shader, for
+    // drawing many instances in one call. The vertex shader must take the model view
+    // and normal matrices from the per instance attributes of InstanceMatrices (see
+    // renderqueue.h) instead of uniforms. Needs instancingSupported().
+    void enableInstancing(const std::string& instancedVsFilename);
+
+    bool hasInstancing() const { return instancedProgramDesc_ ? true : false; }
+
+    // Split form of draw(), for drawing several geometries in a row with the same
+    // material (see RenderQueue):
+    //   bind()            uses the program, applies the render states and sends the
+    //                     material's own uniforms and textures
+    //   bindGeometry()    wires and binds the vertex attributes of a geometry
+    //   drawBound()       sends the remaining uniforms and draws the bound geometry
+    //   unbindGeometry()  disables the vertex attributes again
+    // No other material may be drawn between bind() and the last drawBound().
+    //
+    // For instanced drawing, bind(true) uses the instanced program, bindGeometry()
+    // takes the vbo holding the per instance attributes, and drawBoundInstanced()
+    // draws that many instances.
+    void bind(bool instanced = false);
+
+    void bindGeometry(Geometry& geometry, const FormattedVbo* instances = NULL);
+
+    void drawBound(const Uniforms& extraUniforms);
+
+    void drawBoundInstanced(int numInstances, const Uniforms& extraUniforms);
+
+    void unbindGeometry();
+
+    // Keys for sorting draws so that identical GL states end up next to each other
+    GLuint getProgram(bool instanced = false) const;
+
+    const Texture* getFirstTexture() const;
+
     Uniforms& getUniforms() { return uniforms_; }
 
     const Uniforms& getUniforms() const { return uniforms_; }
@@ -34,9 +69,32 @@ public:
 protected:
     std::shared_ptr<GlProgramDesc> programDesc_;
 
+    std::shared_ptr<GlProgramDesc> instancedProgramDesc_;
+
+    std::string fsFilename_;
+
     Uniforms uniforms_;
 
     RenderStates renderStates_;
+
+private:
+    // Send the uniforms of the program, each taken from the first of `lists' that
+    // supplies it. Those found in lists before `firstSent' are skipped, as they are
+    // already current. If `requireAll', a uniform found nowhere is an error.
+    // Textures are bound from `textureUnit' on; returns the next free unit.
+    int sendUniforms(const Uniforms* const lists[], int numLists, int firstSent, bool requireAll, int textureUnit);
+
+    // Send the uniforms not supplied by the material, for drawBound*()
+    void sendDrawUniforms(const Uniforms& extraUniforms);
+
+    std::shared_ptr<GlProgramDesc> boundProgramDesc_; // program of the last bind()
+    int materialTextureUnits_;      // texture units used by the last bind()
+
+    Geometry* boundGeometry_;
+    std::vector<int> boundAttribs_; // attribute locations for boundGeometry_
+
+    // (attribute index in the instance format, location) of per instance attributes
+    std::vector<std::pair<int, int> > boundInstanceAttribs_;
 };
 
 
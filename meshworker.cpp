@@ -0,0 +1,99 @@
+#include <utility>
+
+#include "subdivision.h"
+#include "meshworker.h"
+
+using namespace std;
+
+void asd::pack_vertices_pn(Mesh& mesh, bool do_smooth_shading, std::vector<VertexPN>& out) {
+    auto mesh_vertex_to_vertexPN = [](Mesh::Vertex from, Cvec3 normal) -> VertexPN {
+        auto ret = VertexPN{};
+        auto cvec3_to_cvec3f = [](Cvec3 cvec3) -> Cvec3f {
+            auto ret = Cvec3f{};
+            for (int i = 0; i < 3; i++) {
+                ret[i] = static_cast<float>(cvec3[i]);
+            }
+            return ret;
+        };
+        ret.p = cvec3_to_cvec3f(from.getPosition());
+        ret.n = cvec3_to_cvec3f(normal);
+        return ret;
+    };
+
+    out.clear();
+    for (int face_ind = 0; face_ind < mesh.getNumFaces(); face_ind++) {
+        const auto& face = mesh.getFace(face_ind);
+        const auto push_mesh_vertex = [&](int vertex_ind) {
+            auto&& v = face.getVertex(vertex_ind);
+            out.push_back(mesh_vertex_to_vertexPN(v, do_smooth_shading ? v.getNormal() : face.getNormal()));
+        };
+        for (int second_v_ind = 1; second_v_ind < face.getNumVertices() - 1; second_v_ind++) {
+            push_mesh_vertex(0);
+            push_mesh_vertex(second_v_ind);
+            push_mesh_vertex(second_v_ind + 1);
+        }
+    }
+    assert(out.size() % 3 == 0);
+}
+
+MeshRefineWorker::MeshRefineWorker(const Mesh& reference, Deform deform)
+        : reference_(reference), deform_(std::move(deform)),
+          hasPendingJob_(false), stopRequested_(false),
+          front_(&buffers_[0]), ready_(&buffers_[1]), back_(&buffers_[2]), readyIsFresh_(false) {
+    // start the thread last, once every member it reads is initialized
+    thread_ = thread(&MeshRefineWorker::run, this);
+}
+
+MeshRefineWorker::~MeshRefineWorker() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopRequested_ = true;
+    }
+    jobPosted_.notify_one();
+    thread_.join();
+}
+
+void MeshRefineWorker::request(const Job& job) {
+    {
+        lock_guard<mutex> lock(mutex_);
+        pendingJob_ = job;
+        hasPendingJob_ = true;
+    }
+    jobPosted_.notify_one();
+}
+
+const vector<VertexPN>* MeshRefineWorker::acquireLatest() {
+    lock_guard<mutex> lock(mutex_);
+    if (!readyIsFresh_)
+        return NULL;
+    swap(front_, ready_);
+    readyIsFresh_ = false;
+    return front_;
+}
+
+void MeshRefineWorker::run() {
+    for (;;) {
+        Job job;
+        {
+            unique_lock<mutex> lock(mutex_);
+            jobPosted_.wait(lock, [this] { return hasPendingJob_ || stopRequested_; });
+            if (stopRequested_)
+                return;
+            job = pendingJob_;
+            hasPendingJob_ = false;
+        }
+
+        Mesh mesh = reference_;
+        deform_(mesh, job.step);
+        for (int i = 0; i < job.levels; ++i)
+            asd::subdivide(mesh);
+        asd::set_averaged_normals(mesh);
+        asd::pack_vertices_pn(mesh, job.smooth, *back_);
+
+        // publish the finished frame, taking the old ready buffer (or the one the GL
+        // thread just released) as the next back buffer
+        lock_guard<mutex> lock(mutex_);
+        swap(back_, ready_);
+        readyIsFresh_ = true;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef MESHWORKER_H
+#define MESHWORKER_H
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "mesh.h"
+#include "glsupport.h" // for Noncopyable
+#include "geometry.h"
+
+namespace asd {
+    // Triangulate the faces of the mesh into a flat VertexPN triangle soup, using vertex
+    // normals if do_smooth_shading is set and face normals otherwise. `out' is overwritten.
+    void pack_vertices_pn(Mesh& mesh, bool do_smooth_shading, std::vector<VertexPN>& out);
+}
+
+// Produces deformed, subdivided and shaded vertex arrays of a reference mesh on a
+// background thread, so that none of that CPU work happens on the GL thread.
+//
+// The GL thread posts jobs with request(); only the latest unstarted job is kept.
+// Finished frames go through a triple buffer: the worker fills its back buffer and
+// publishes it as the ready buffer, and acquireLatest() swaps the ready buffer to
+// the front. Neither side ever waits for the other to finish a frame.
+class MeshRefineWorker : Noncopyable {
+public:
+    struct Job {
+        int step;          // animation time passed to the deform function
+        int levels;        // number of subdivision steps
+        bool smooth;       // smooth or flat shading normals
+    };
+
+    // Deforms the copy of the reference mesh in place for a given step. Runs on the
+    // worker thread, so it must not touch GL or unsynchronized shared state
+    typedef std::function<void(Mesh& mesh, int step)> Deform;
+
+    MeshRefineWorker(const Mesh& reference, Deform deform);
+
+    // Stops and joins the worker thread
+    ~MeshRefineWorker();
+
+    // Ask for a new frame. Replaces a previous request that was not started yet
+    void request(const Job& job);
+
+    // If a frame was finished since the last call, make it the front buffer and
+    // return it. Otherwise returns NULL. The returned vertices stay valid until the
+    // next call.
+    const std::vector<VertexPN>* acquireLatest();
+
+private:
+    void run();
+
+    const Mesh reference_;
+    const Deform deform_;
+
+    std::mutex mutex_;
+    std::condition_variable jobPosted_;
+    Job pendingJob_;
+    bool hasPendingJob_, stopRequested_;
+
+    // Triple buffer. front_ belongs to the GL thread and back_ to the worker,
+    // ready_ is only swapped under mutex_
+    std::vector<VertexPN> buffers_[3];
+    std::vector<VertexPN>* front_, * ready_, * back_;
+    bool readyIsFresh_;
+
+    std::thread thread_;
+};
+
+#endif
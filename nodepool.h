@@ -0,0 +1,176 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cassert>
+#include <type_traits>
+
+#include "glsupport.h" // for Noncopyable
+
+// Reference to an object of a NodePool. Unlike a pointer it can be checked: once
+// the object is destroyed, the handle resolves to NULL even if its slot has been
+// reused for another object. A default constructed handle never resolves.
+template<typename T>
+struct PoolHandle {
+    unsigned index;
+    unsigned generation;   // 0 is never used by a live object
+
+    PoolHandle() : index(0), generation(0) {}
+
+    PoolHandle(unsigned _index, unsigned _generation) : index(_index), generation(_generation) {}
+
+    bool operator==(const PoolHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const PoolHandle& other) const {
+        return !(*this == other);
+    }
+};
+
+// Storage for objects of one type, allocated in fixed size chunks so that they sit
+// next to each other in memory and never move. Freed slots are reused, each time
+// with a new generation so that old handles to them go stale.
+//
+// Not thread safe: objects must be created and destroyed on one thread, like the
+// scene graph is built.
+template<typename T>
+class NodePool : Noncopyable {
+public:
+    typedef PoolHandle<T> Handle;
+
+    static const int CHUNK_SIZE = 256;
+
+    NodePool() : numSlots_(0), firstFree_(-1), size_(0) {}
+
+    ~NodePool() {
+        for (int i = 0; i < numSlots_; ++i) {
+            if (slot(i).alive)
+                object(slot(i))->~T();
+        }
+    }
+
+    template<typename... Args>
+    Handle create(Args&& ... args) {
+        if (firstFree_ < 0) {
+            if (numSlots_ % CHUNK_SIZE == 0)
+                chunks_.push_back(std::unique_ptr<Slot[]>(new Slot[CHUNK_SIZE]));
+            slot(numSlots_).index = numSlots_;
+            firstFree_ = numSlots_++;
+        }
+
+        const int i = firstFree_;
+        Slot& s = slot(i);
+        new(&s.storage) T(std::forward<Args>(args)...);   // may throw, the slot is still free then
+        firstFree_ = s.nextFree;
+        s.alive = true;
+        if (++s.generation == 0)
+            ++s.generation;
+        ++size_;
+        return Handle(i, s.generation);
+    }
+
+    void destroy(Handle h) {
+        T* p = get(h);
+        assert(p != NULL);
+        if (p == NULL)
+            return;
+        Slot& s = slot(h.index);
+        s.alive = false;     // first, so that get() fails for the destructor's callees
+        p->~T();
+        s.nextFree = firstFree_;
+        firstFree_ = h.index;
+        --size_;
+    }
+
+    // The object, or NULL if the handle is stale
+    T* get(Handle h) const {
+        if (h.generation == 0 || h.index >= unsigned(numSlots_))
+            return NULL;
+        Slot& s = slot(h.index);
+        return s.alive && s.generation == h.generation ? object(s) : NULL;
+    }
+
+    // True if p is a live object of this pool
+    bool contains(const T* p) const {
+        for (size_t c = 0; c < chunks_.size(); ++c) {
+            const void* begin = &chunks_[c][0], * end = &chunks_[c][0] + CHUNK_SIZE;
+            if (p >= begin && p < end)
+                return slotOf(p).alive;
+        }
+        return false;
+    }
+
+    // Handle of a live object of this pool, or a null handle for any other pointer
+    Handle getHandle(const T* p) const {
+        if (!p || !contains(p))
+            return Handle();
+        const Slot& s = slotOf(p);
+        return Handle(s.index, s.generation);
+    }
+
+    // Number of live objects
+    int size() const {
+        return size_;
+    }
+
+    // Call f(T&) on every live object, in storage order
+    template<typename F>
+    void forEach(F f) {
+        for (int i = 0; i < numSlots_; ++i) {
+            if (slot(i).alive)
+                f(*object(slot(i)));
+        }
+    }
+
+private:
+    struct Slot {
+        // first member, so that an object's address is its slot's
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        unsigned index;
+        unsigned generation;
+        int nextFree;
+        bool alive;
+
+        Slot() : index(0), generation(0), nextFree(-1), alive(false) {}
+    };
+
+    Slot& slot(int i) const {
+        return chunks_[i / CHUNK_SIZE][i % CHUNK_SIZE];
+    }
+
+    static T* object(Slot& s) {
+        return reinterpret_cast<T*>(&s.storage);
+    }
+
+    static const Slot& slotOf(const T* p) {
+        return *reinterpret_cast<const Slot*>(p);
+    }
+
+    std::vector<std::unique_ptr<Slot[]> > chunks_;
+    int numSlots_;
+    int firstFree_;    // head of the free slot list, -1 if none
+    int size_;
+};
+
+// The pool holding the pooled nodes of exact type T. It is never destroyed, so
+// that shared_ptrs in static objects can still release their nodes at exit.
+template<typename T>
+NodePool<T>& getNodePool() {
+    static NodePool<T>* pool = new NodePool<T>();
+    return *pool;
+}
+
+// Create a node in its type's pool, owned by shared_ptrs as usual. The slot goes
+// back to the pool with the last shared_ptr. Handles can be obtained from
+// getNodePool<T>().getHandle().
+template<typename T, typename... Args>
+std::shared_ptr<T> makePooledNode(Args&& ... args) {
+    NodePool<T>& pool = getNodePool<T>();
+    const PoolHandle<T> h = pool.create(std::forward<Args>(args)...);
+    return std::shared_ptr<T>(pool.get(h), [h](T*) { getNodePool<T>().destroy(h); });
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "occlusion.h"
+
+using namespace std;
+
+const int OcclusionBuffer::BATCH;
+
+// Depth of the pixels no occluder covers, farther than anything
+static const float NO_OCCLUDER = -numeric_limits<float>::max();
+
+static bool sameMatrix(const Matrix4& a, const Matrix4& b) {
+    for (int i = 0; i < 16; ++i) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+        : width_(width), height_(height), stride_((width + BATCH - 1) / BATCH * BATCH),
+          depths_(stride_ * height, NO_OCCLUDER), rasterized_(false), version_(0) {}
+
+void OcclusionBuffer::addOccluder(shared_ptr<SgTransformNode> node,
+                                  const vector<Cvec3f>& vertices, const vector<unsigned>& indices) {
+    Occluder occluder;
+    occluder.node = std::move(node);
+    occluder.vertices = vertices;
+    occluder.indices = indices;
+    occluders_.push_back(occluder);
+    rasterized_ = false;
+}
+
+void OcclusionBuffer::clearOccluders() {
+    occluders_.clear();
+    rasterized_ = false;
+}
+
+bool OcclusionBuffer::update(const RigTForm& invEyeRbt, const Matrix4& projection) {
+    bool moved = !rasterized_ || !sameMatrix(projection, projection_);
+    for (size_t i = 0; i < occluders_.size(); ++i) {
+        Occluder& o = occluders_[i];
+        const Matrix4 MVM = rigTFormToMatrix(invEyeRbt * o.node->getWorldRbt());
+        if (!sameMatrix(MVM, o.MVM)) {
+            o.MVM = MVM;
+            moved = true;
+        }
+    }
+    if (!moved)
+        return false;
+
+    projection_ = projection;
+    fill(depths_.begin(), depths_.end(), NO_OCCLUDER);
+    for (size_t i = 0; i < occluders_.size(); ++i)
+        rasterize(occluders_[i]);
+    rasterized_ = true;
+    ++version_;
+    return true;
+}
+
+void OcclusionBuffer::rasterize(const Occluder& occluder) {
+    // project the vertices to pixel coordinates and NDC z
+    const Matrix4 MVP = projection_ * occluder.MVM;
+    const int numVertices = occluder.vertices.size();
+    sx_.resize(numVertices);
+    sy_.resize(numVertices);
+    sz_.resize(numVertices);
+    clipped_.resize(numVertices);
+    for (int i = 0; i < numVertices; ++i) {
+        const Cvec3f& v = occluder.vertices[i];
+        const Cvec4 c = MVP * Cvec4(v[0], v[1], v[2], 1);
+        clipped_[i] = c[2] > c[3] || c[3] <= 0;
+        if (clipped_[i])
+            continue;
+        sx_[i] = float((c[0] / c[3] * 0.5 + 0.5) * width_);
+        sy_[i] = float((c[1] / c[3] * 0.5 + 0.5) * height_);
+        sz_[i] = float(c[2] / c[3]);
+    }
+
+    const vector<unsigned>& indices = occluder.indices;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        int v0 = indices[t], v1 = indices[t + 1], v2 = indices[t + 2];
+        if (clipped_[v0] || clipped_[v1] || clipped_[v2])
+            continue;
+        float area = (sx_[v1] - sx_[v0]) * (sy_[v2] - sy_[v0]) - (sx_[v2] - sx_[v0]) * (sy_[v1] - sy_[v0]);
+        if (area == 0)
+            continue;
+        if (area < 0) {
+            swap(v1, v2);
+            area = -area;
+        }
+        const int v[3] = {v0, v1, v2};
+
+        const int x0 = max(0, int(floor(min(sx_[v0], min(sx_[v1], sx_[v2])))));
+        const int x1 = min(width_, int(ceil(max(sx_[v0], max(sx_[v1], sx_[v2])))));
+        const int y0 = max(0, int(floor(min(sy_[v0], min(sy_[v1], sy_[v2])))));
+        const int y1 = min(height_, int(ceil(max(sy_[v0], max(sy_[v1], sy_[v2])))));
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        // Edge functions a x + b y + c, at least 0 on the whole pixel around
+        // (x, y) exactly when that pixel lies inside the edge
+        float a[3], b[3], c[3];
+        for (int k = 0; k < 3; ++k) {
+            const int i = v[k], j = v[(k + 1) % 3];
+            a[k] = sy_[i] - sy_[j];
+            b[k] = sx_[j] - sx_[i];
+            c[k] = -a[k] * sx_[i] - b[k] * sy_[i] - 0.5f * (fabs(a[k]) + fabs(b[k]));
+        }
+        // Depth plane dx x + dy y + dc, lowered to its farthest over the pixel
+        const float dz1 = sz_[v1] - sz_[v0], dz2 = sz_[v2] - sz_[v0];
+        const float dx = (dz1 * (sy_[v2] - sy_[v0]) - dz2 * (sy_[v1] - sy_[v0])) / area;
+        const float dy = (dz2 * (sx_[v1] - sx_[v0]) - dz1 * (sx_[v2] - sx_[v0])) / area;
+        const float dc = sz_[v0] - dx * sx_[v0] - dy * sy_[v0] - 0.5f * (fabs(dx) + fabs(dy));
+
+        const float a0 = a[0], a1 = a[1], a2 = a[2];
+        for (int y = y0; y < y1; ++y) {
+            const float fy = y + 0.5f;
+            const float r0 = b[0] * fy + c[0], r1 = b[1] * fy + c[1], r2 = b[2] * fy + c[2];
+            const float rz = dy * fy + dc;
+            float* row = &depths_[y * stride_];
+            // pixels of a batch outside the triangle fail the edge test
+            for (int first = x0 / BATCH * BATCH; first < x1; first += BATCH) {
+                float* __restrict p = row + first;
+                for (int k = 0; k < BATCH; ++k) {
+                    const float fx = float(first + k) + 0.5f;
+                    const float e = min(a0 * fx + r0, min(a1 * fx + r1, a2 * fx + r2));
+                    const float z = dx * fx + rz;
+                    p[k] = e >= 0 ? max(p[k], z) : p[k];
+                }
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::isOccluded(const Bounds& eyeBounds) const {
+    if (eyeBounds.isEmpty())
+        return true;
+    if (eyeBounds.isInfinite() || !rasterized_ || occluders_.empty())
+        return false;
+
+    // screen rectangle and nearest depth of the box; the extremes of a convex
+    // volume in front of the eye lie at its corners
+    const Cvec3& lo = eyeBounds.getBoxMin();
+    const Cvec3& hi = eyeBounds.getBoxMax();
+    double minX = width_, maxX = 0, minY = height_, maxY = 0, nearest = -1;
+    for (int i = 0; i < 8; ++i) {
+        const Cvec4 c = projection_ * Cvec4(i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1], i & 4 ? hi[2] : lo[2], 1);
+        if (c[2] > c[3] || c[3] <= 0)
+            return false;
+        const double x = (c[0] / c[3] * 0.5 + 0.5) * width_, y = (c[1] / c[3] * 0.5 + 0.5) * height_;
+        minX = min(minX, x);
+        maxX = max(maxX, x);
+        minY = min(minY, y);
+        maxY = max(maxY, y);
+        nearest = max(nearest, c[2] / c[3]);
+    }
+    const int x0 = int(floor(max(minX, 0.))), x1 = int(ceil(min(maxX, double(width_))));
+    const int y0 = int(floor(max(minY, 0.))), y1 = int(ceil(min(maxY, double(height_))));
+    if (x0 >= x1 || y0 >= y1)
+        return false;
+
+    // hidden if every pixel has an occluder in front; the batches are masked to
+    // the rectangle rather than cut, so their fixed length loops vectorize
+    const float z = float(nearest);
+    for (int y = y0; y < y1; ++y) {
+        const float* row = &depths_[y * stride_];
+        for (int first = x0 / BATCH * BATCH; first < x1; first += BATCH) {
+            const float* __restrict p = row + first;
+            int visible = 0;
+            for (int k = 0; k < BATCH; ++k) {
+                const int x = first + k;
+                visible |= (x >= x0) & (x < x1) & (p[k] <= z);
+            }
+            if (visible)
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "rigtform.h"
+#include "bounds.h"
+#include "scenegraph.h"
+
+// A coarse depth buffer on the CPU for occlusion culling. A few designated
+// occluders, triangle meshes that lie within what is drawn in the frame of a
+// transform node (e.g., a quad inside a wall), are rasterized into it, and the
+// bounds of shapes and subtrees are then tested against it before they are
+// drawn, see Drawer and FlatScene::draw().
+//
+// Depths are NDC z, so nearer is larger as in the GL depth test of this program.
+// Both sides of the test are conservative: an occluder only covers the pixels
+// that lie entirely within one of its triangles, with the farthest depth it has
+// over them, and bounds are tested with their nearest depth over the whole
+// screen rectangle of their box. Triangles that cross the near plane are
+// skipped. The rows are padded to a multiple of BATCH pixels. Rasterizing walks
+// a triangle's bounding rectangle BATCH pixels at a time, keeping the max of the
+// old depth and the triangle's depth plane where all three edge functions pass;
+// the test masks each batch to the box's rectangle and ORs the lanes nearer than
+// the box. Neither branches per pixel, so both loops vectorize.
+class OcclusionBuffer {
+public:
+    static const int BATCH = 8;
+
+    // Resolution of the buffer; it covers the whole viewport whatever its size
+    OcclusionBuffer(int width, int height);
+
+    // Designate an occluder: triangles in the frame of `node', three indices each,
+    // which must not cover anything that is not drawn there
+    void addOccluder(std::shared_ptr<SgTransformNode> node,
+                     const std::vector<Cvec3f>& vertices, const std::vector<unsigned>& indices);
+
+    void clearOccluders();
+
+    // Rasterize the occluders as seen from a view, unless neither the view nor an
+    // occluder moved since the last call. World rbts are relative to the root of
+    // the occluders' tree. Returns whether the depths changed.
+    bool update(const RigTForm& invEyeRbt, const Matrix4& projection);
+
+    // True if the bounds, given in eye coordinates, are completely hidden behind
+    // the occluders. Empty bounds always are and infinite ones never are.
+    bool isOccluded(const Bounds& eyeBounds) const;
+
+    // Incremented every time the depths change
+    unsigned long getVersion() const {
+        return version_;
+    }
+
+    int getWidth() const {
+        return width_;
+    }
+
+    int getHeight() const {
+        return height_;
+    }
+
+    // Depth of pixel (x, y), y counted from the bottom
+    float getDepth(int x, int y) const {
+        return depths_[y * stride_ + x];
+    }
+
+private:
+    struct Occluder {
+        std::shared_ptr<SgTransformNode> node;
+        std::vector<Cvec3f> vertices;
+        std::vector<unsigned> indices;
+        Matrix4 MVM;        // at the last rasterization
+    };
+
+    int width_, height_, stride_;
+    std::vector<float> depths_;
+    std::vector<Occluder> occluders_;
+    Matrix4 projection_;
+    bool rasterized_;
+    unsigned long version_;
+
+    // Per vertex of the occluder being rasterized: pixel coordinates and depth,
+    // and whether it is in front of the near plane
+    std::vector<float> sx_, sy_, sz_;
+    std::vector<char> clipped_;
+
+    void rasterize(const Occluder& occluder);
+};
+
+#endif
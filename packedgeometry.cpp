@@ -0,0 +1,159 @@
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+#include "packedgeometry.h"
+
+using namespace std;
+
+const VertexFormat VertexPackedPN::FORMAT = VertexFormat(sizeof(VertexPackedPN))
+        .put("aPosition", 3, GL_SHORT, GL_TRUE, offsetof(VertexPackedPN, p))
+        .put("aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPN, n));
+
+const VertexFormat VertexPackedPNX::FORMAT = VertexFormat(sizeof(VertexPackedPNX))
+        .put("aPosition", 3, GL_SHORT, GL_TRUE, offsetof(VertexPackedPNX, p))
+        .put("aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPNX, n))
+        .put("aTexCoord", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(VertexPackedPNX, x));
+
+const VertexFormat VertexPackedPNTBX::FORMAT = VertexFormat(sizeof(VertexPackedPNTBX))
+        .put("aPosition", 3, GL_SHORT, GL_TRUE, offsetof(VertexPackedPNTBX, p))
+        .put("aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPNTBX, n))
+        .put("aTangent", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPNTBX, t))
+        .put("aBinormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPNTBX, b))
+        .put("aTexCoord", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(VertexPackedPNTBX, x));
+
+bool packedVerticesSupported() {
+    return GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+}
+
+PositionQuantizer::PositionQuantizer(const Cvec3& boxMin, const Cvec3& boxMax)
+        : center_((boxMin + boxMax) * 0.5), halfExtent_(0) {
+    for (int i = 0; i < 3; ++i)
+        halfExtent_ = max(halfExtent_, (boxMax[i] - boxMin[i]) * 0.5);
+    if (halfExtent_ < CS175_EPS)
+        halfExtent_ = 1;
+}
+
+void PositionQuantizer::encode(const Cvec3f& p, GLshort out[3]) const {
+    for (int i = 0; i < 3; ++i)
+        out[i] = packSnorm16(float((p[i] - center_[i]) / halfExtent_));
+}
+
+GLshort packSnorm16(float v) {
+    return GLshort(lround(min(max(v, -1.f), 1.f) * 32767));
+}
+
+// x, y and z in the low 30 bits as signed 10 bit values, w = 0
+GLuint packSnorm1010102(const Cvec3f& v) {
+    GLuint packed = 0;
+    for (int i = 0; i < 3; ++i) {
+        const int c = int(lround(min(max(v[i], -1.f), 1.f) * 511));
+        packed |= (GLuint(c) & 0x3ff) << (10 * i);
+    }
+    return packed;
+}
+
+// IEEE 754 binary16, rounding to nearest even
+GLushort packHalf(float v) {
+    GLuint f;
+    memcpy(&f, &v, sizeof(f));
+    const GLuint sign = (f >> 16) & 0x8000;
+    const GLuint absf = f & 0x7fffffff;
+
+    if (absf >= 0x7f800000) // inf or nan
+        return GLushort(sign | 0x7c00 | (absf > 0x7f800000 ? 0x200 : 0));
+    if (absf >= 0x477ff000) // rounds to a value beyond the largest half
+        return GLushort(sign | 0x7c00);
+    if (absf < 0x38800000) { // denormal half, or zero
+        const int shift = 126 - int(absf >> 23);
+        if (shift > 24)
+            return GLushort(sign);
+        const GLuint mantissa = (absf & 0x7fffff) | 0x800000;
+        GLuint h = mantissa >> shift;
+        const GLuint rest = mantissa & ((1u << shift) - 1), half = 1u << (shift - 1);
+        if (rest > half || (rest == half && (h & 1)))
+            ++h;
+        return GLushort(sign | h);
+    }
+
+    GLuint h = ((absf - 0x38000000) >> 13);
+    const GLuint rest = absf & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        ++h;
+    return GLushort(sign | h);
+}
+
+float unpackSnorm16(GLshort v) {
+    return max(v / 32767.f, -1.f);
+}
+
+Cvec4f unpackSnorm1010102(GLuint v) {
+    Cvec4f r;
+    for (int i = 0; i < 3; ++i) {
+        int c = (v >> (10 * i)) & 0x3ff;
+        if (c & 0x200)
+            c -= 0x400;
+        r[i] = max(c / 511.f, -1.f);
+    }
+    int w = (v >> 30) & 0x3;
+    if (w & 0x2)
+        w -= 0x4;
+    r[3] = max(float(w), -1.f);
+    return r;
+}
+
+float unpackHalf(GLushort v) {
+    const GLuint sign = GLuint(v & 0x8000) << 16;
+    const GLuint exponent = (v >> 10) & 0x1f;
+    GLuint mantissa = v & 0x3ff;
+
+    GLuint f;
+    if (exponent == 0x1f) // inf or nan
+        f = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        f = sign;
+    else { // denormal half, normal float
+        int e = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --e;
+        }
+        f = sign | (GLuint(e) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float r;
+    memcpy(&r, &f, sizeof(r));
+    return r;
+}
+
+PositionQuantizer makePositionQuantizer(const GenericVertex* vertices, int numVertices) {
+    if (numVertices == 0)
+        return PositionQuantizer();
+
+    Cvec3 boxMin(vertices[0].pos[0], vertices[0].pos[1], vertices[0].pos[2]), boxMax = boxMin;
+    for (int i = 1; i < numVertices; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            boxMin[j] = min(boxMin[j], double(vertices[i].pos[j]));
+            boxMax[j] = max(boxMax[j], double(vertices[i].pos[j]));
+        }
+    }
+    return PositionQuantizer(boxMin, boxMax);
+}
+
+void meshToGenericVertices(Mesh& mesh, bool smoothNormals, vector<GenericVertex>& out) {
+    out.clear();
+    for (int f = 0, nf = mesh.getNumFaces(); f < nf; ++f) {
+        const Mesh::Face face = mesh.getFace(f);
+        const Cvec3 faceNormal = face.getNormal();
+        for (int k = 1; k < face.getNumVertices() - 1; ++k) {
+            const int corners[3] = {0, k, k + 1};
+            for (int c = 0; c < 3; ++c) {
+                const Mesh::Vertex v = face.getVertex(corners[c]);
+                const Cvec3 p = v.getPosition(), n = smoothNormals ? v.getNormal() : faceNormal;
+                out.push_back(GenericVertex(p[0], p[1], p[2], n[0], n[1], n[2], 0, 0, 0, 0, 0, 0, 0, 0));
+            }
+        }
+    }
+}
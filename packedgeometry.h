@@ -0,0 +1,198 @@
+#ifndef PACKEDGEOMETRY_H
+#define PACKEDGEOMETRY_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "mesh.h"
+#include "geometrymaker.h"
+#include "geometry.h"
+
+// =============================================================================
+// Compressed counterparts of VertexPN, VertexPNX and VertexPNTBX:
+//   - positions as 16 bit normalized shorts, relative to the geometry's bounds
+//   - normals, tangents and binormals as GL_INT_2_10_10_10_REV
+//   - texture coordinates as half floats
+// VertexPackedPNTBX is 24 bytes instead of 56. The shaders see the same aPosition,
+// aNormal, ... attributes as with the float formats, except that positions come
+// out in [-1, 1]; the geometry's getPositionDecode() maps them back.
+//
+// GL_INT_2_10_10_10_REV needs OpenGL 3.3 or ARB_vertex_type_2_10_10_10_rev, check
+// packedVerticesSupported() before using these formats.
+// =============================================================================
+
+// True if the current GL context can source the packed vertex formats
+bool packedVerticesSupported();
+
+// Quantization of positions to [-1, 1]^3. The scale is the same along all axes so
+// that the decode matrix does not change the direction of normals.
+class PositionQuantizer {
+public:
+    PositionQuantizer() : center_(0), halfExtent_(1) {}
+
+    // Quantizer for positions in the box [boxMin, boxMax]
+    PositionQuantizer(const Cvec3& boxMin, const Cvec3& boxMax);
+
+    // Maps quantized positions back to model space
+    Matrix4 getDecodeMatrix() const {
+        return Matrix4::makeTranslation(center_) * Matrix4::makeScale(Cvec3(halfExtent_));
+    }
+
+    void encode(const Cvec3f& p, GLshort out[3]) const;
+
+private:
+    Cvec3 center_;
+    double halfExtent_;
+};
+
+// Scalar packing helpers
+GLshort packSnorm16(float v);
+
+GLuint packSnorm1010102(const Cvec3f& v);
+
+GLushort packHalf(float v);
+
+// and their inverses, as GL does them when sourcing normalized attributes
+float unpackSnorm16(GLshort v);
+
+// x, y, z and w of a GL_INT_2_10_10_10_REV value
+Cvec4f unpackSnorm1010102(GLuint v);
+
+float unpackHalf(GLushort v);
+
+// The packed vertex types are plain standard-layout structs, without a common
+// base, so that offsetof() on their members is well-defined. Their fields that
+// share a name share their offset too.
+struct VertexPackedPN {
+    GLshort p[4]; // the fourth component only pads the normal to a 4 byte boundary
+    GLuint n;
+
+    static const VertexFormat FORMAT;
+
+    void set(const GenericVertex& v, const PositionQuantizer& quantizer) {
+        quantizer.encode(v.pos, p);
+        p[3] = 0;
+        n = packSnorm1010102(v.normal);
+    }
+};
+
+struct VertexPackedPNX {
+    GLshort p[4];
+    GLuint n;
+    GLushort x[2];
+
+    static const VertexFormat FORMAT;
+
+    void set(const GenericVertex& v, const PositionQuantizer& quantizer) {
+        quantizer.encode(v.pos, p);
+        p[3] = 0;
+        n = packSnorm1010102(v.normal);
+        x[0] = packHalf(v.tex[0]);
+        x[1] = packHalf(v.tex[1]);
+    }
+};
+
+struct VertexPackedPNTBX {
+    GLshort p[4];
+    GLuint n;
+    GLushort x[2];
+    GLuint t, b;
+
+    static const VertexFormat FORMAT;
+
+    void set(const GenericVertex& v, const PositionQuantizer& quantizer) {
+        quantizer.encode(v.pos, p);
+        p[3] = 0;
+        n = packSnorm1010102(v.normal);
+        x[0] = packHalf(v.tex[0]);
+        x[1] = packHalf(v.tex[1]);
+        t = packSnorm1010102(v.tangent);
+        b = packSnorm1010102(v.binormal);
+    }
+};
+
+// Positions as the vertex shader sees them, before the decode matrix
+inline Cvec3 vertexPosition(const VertexPackedPN& v) {
+    return Cvec3(v.p[0], v.p[1], v.p[2]) / 32767.;
+}
+
+inline Cvec3 vertexPosition(const VertexPackedPNX& v) {
+    return Cvec3(v.p[0], v.p[1], v.p[2]) / 32767.;
+}
+
+inline Cvec3 vertexPosition(const VertexPackedPNTBX& v) {
+    return Cvec3(v.p[0], v.p[1], v.p[2]) / 32767.;
+}
+
+// Quantizer covering the positions of all the vertices
+PositionQuantizer makePositionQuantizer(const GenericVertex* vertices, int numVertices);
+
+// Pack `numVertices' vertices into `out' relative to their own bounds, and return
+// the quantizer used
+template<typename PackedVertex>
+PositionQuantizer packVertices(const GenericVertex* vertices, int numVertices, std::vector<PackedVertex>& out) {
+    const PositionQuantizer quantizer = makePositionQuantizer(vertices, numVertices);
+    out.resize(numVertices);
+    for (int i = 0; i < numVertices; ++i)
+        out[i].set(vertices[i], quantizer);
+    return quantizer;
+}
+
+// Triangulate the faces of the mesh into a GenericVertex triangle soup, with vertex
+// normals if smoothNormals is set and face normals otherwise. Texture coordinates,
+// tangents and binormals are zero. `out' is overwritten.
+void meshToGenericVertices(Mesh& mesh, bool smoothNormals, std::vector<GenericVertex>& out);
+
+// Indexed geometry in one of the packed formats, which knows its position decode
+template<typename PackedVertex, typename Index>
+class PackedIndexedGeometry : public SimpleIndexedGeometry<PackedVertex, Index> {
+    Matrix4 decode_;
+public:
+    PackedIndexedGeometry(const GenericVertex* vertices, const Index* indices, int numVertices, int numIndices) {
+        upload(vertices, indices, numVertices, numIndices);
+    }
+
+    void upload(const GenericVertex* vertices, const Index* indices, int numVertices, int numIndices) {
+        std::vector<PackedVertex> packed;
+        decode_ = packVertices(vertices, numVertices, packed).getDecodeMatrix();
+        SimpleIndexedGeometry<PackedVertex, Index>::upload(&packed[0], indices, numVertices, numIndices);
+    }
+
+    virtual const Matrix4* getPositionDecode() const {
+        return &decode_;
+    }
+};
+
+// Unindexed geometry in one of the packed formats, which knows its position decode
+template<typename PackedVertex>
+class PackedUnindexedGeometry : public SimpleUnindexedGeometry<PackedVertex> {
+    Matrix4 decode_;
+public:
+    PackedUnindexedGeometry() {}
+
+    PackedUnindexedGeometry(const GenericVertex* vertices, int numVertices) {
+        upload(vertices, numVertices);
+    }
+
+    void upload(const GenericVertex* vertices, int numVertices) {
+        std::vector<PackedVertex> packed;
+        decode_ = packVertices(vertices, numVertices, packed).getDecodeMatrix();
+        SimpleUnindexedGeometry<PackedVertex>::upload(&packed[0], numVertices);
+    }
+
+    virtual const Matrix4* getPositionDecode() const {
+        return &decode_;
+    }
+};
+
+typedef PackedUnindexedGeometry<VertexPackedPN> PackedGeometryPN;
+typedef PackedUnindexedGeometry<VertexPackedPNX> PackedGeometryPNX;
+typedef PackedUnindexedGeometry<VertexPackedPNTBX> PackedGeometryPNTBX;
+
+typedef PackedIndexedGeometry<VertexPackedPN, unsigned short> PackedIndexedGeometryPN;
+typedef PackedIndexedGeometry<VertexPackedPNX, unsigned short> PackedIndexedGeometryPNX;
+typedef PackedIndexedGeometry<VertexPackedPNTBX, unsigned short> PackedIndexedGeometryPNTBX;
+
+#endif
@@ -5,14 +5,18 @@
 
 using namespace std;
 
-Picker::Picker(const RigTForm& initialRbt, Uniforms& uniforms)
-        : drawer_(initialRbt, uniforms), idCounter_(0), srgbFrameBuffer_(!g_Gl2Compatible) {}
+Picker::Picker(const RigTForm& initialRbt, Uniforms& uniforms, const Frustum* frustum)
+        : drawer_(initialRbt, uniforms, frustum), idCounter_(0), srgbFrameBuffer_(!g_Gl2Compatible) {}
 
 bool Picker::visit(SgTransformNode& node) {
-    nodeStack_.push_back(node.shared_from_this());
+    nodeStack_.push_back(&node);
     return drawer_.visit(node);
 }
 
+bool Picker::visitChildren(SgTransformNode& node) {
+    return drawer_.visitChildren(node);
+}
+
 bool Picker::postVisit(SgTransformNode& node) {
     nodeStack_.pop_back();
     return drawer_.postVisit(node);
@@ -21,7 +25,7 @@ bool Picker::postVisit(SgTransformNode& node) {
 bool Picker::visit(SgShapeNode& node) {
     idCounter_++;
     for (int i = nodeStack_.size() - 1; i >= 0; --i) {
-        shared_ptr<SgRbtNode> asRbtNode = dynamic_pointer_cast<SgRbtNode>(nodeStack_[i]);
+        SgRbtNode* asRbtNode = dynamic_cast<SgRbtNode*>(nodeStack_[i]);
         if (asRbtNode) {
             addToMap(idCounter_, asRbtNode);
             break;
@@ -55,14 +59,14 @@ shared_ptr<SgRbtNode> Picker::getRbtNodeAtXY(int x, int y) {
 // Helper functions
 //------------------
 //
-void Picker::addToMap(int id, shared_ptr<SgRbtNode> node) {
+void Picker::addToMap(int id, SgRbtNode* node) {
     idToRbtNode_[id] = node;
 }
 
 shared_ptr<SgRbtNode> Picker::find(int id) {
     IdToRbtNodeMap::iterator it = idToRbtNode_.find(id);
     if (it != idToRbtNode_.end())
-        return it->second;
+        return static_pointer_cast<SgRbtNode>(it->second->shared_from_this());
     else
         return shared_ptr<SgRbtNode>(); // set to null
 }
@@ -13,9 +13,11 @@
 #include "drawer.h"
 
 class Picker : public SgNodeVisitor {
-    std::vector<std::shared_ptr<SgNode> > nodeStack_;
+    // Plain pointers: the scene graph is not modified while picking, and shared
+    // ownership is only taken for the node that is finally picked
+    std::vector<SgNode*> nodeStack_;
 
-    typedef std::map<int, std::shared_ptr<SgRbtNode> > IdToRbtNodeMap;
+    typedef std::map<int, SgRbtNode*> IdToRbtNodeMap;
     IdToRbtNodeMap idToRbtNode_;
 
     int idCounter_;
@@ -23,7 +25,7 @@ class Picker : public SgNodeVisitor {
 
     Drawer drawer_;
 
-    void addToMap(int id, std::shared_ptr<SgRbtNode> node);
+    void addToMap(int id, SgRbtNode* node);
 
     std::shared_ptr<SgRbtNode> find(int id);
 
@@ -32,10 +34,12 @@ class Picker : public SgNodeVisitor {
     int colorToId(const PackedPixel& p);
 
 public:
-    Picker(const RigTForm& initialRbt, Uniforms& uniforms);
+    Picker(const RigTForm& initialRbt, Uniforms& uniforms, const Frustum* frustum = NULL);
 
     virtual bool visit(SgTransformNode& node);
 
+    virtual bool visitChildren(SgTransformNode& node);
+
     virtual bool postVisit(SgTransformNode& node);
 
     virtual bool visit(SgShapeNode& node);
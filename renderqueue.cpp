@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+
+#include "asstcommon.h"
+#include "renderqueue.h"
+
+using namespace std;
+
+bool instancingSupported() {
+    return !g_Gl2Compatible && GLEW_VERSION_3_3;
+}
+
+const VertexFormat InstanceMatrices::FORMAT = VertexFormat(sizeof(InstanceMatrices))
+        .put("aModelView0", 4, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, modelView[0]))
+        .put("aModelView1", 4, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, modelView[1]))
+        .put("aModelView2", 4, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, modelView[2]))
+        .put("aModelView3", 4, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, modelView[3]))
+        .put("aNormalMatrix0", 3, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, normalMatrix[0]))
+        .put("aNormalMatrix1", 3, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, normalMatrix[1]))
+        .put("aNormalMatrix2", 3, GL_FLOAT, GL_FALSE, offsetof(InstanceMatrices, normalMatrix[2]));
+
+void InstanceMatrices::set(const Matrix4& MVM, const Matrix4& NMVM) {
+    for (int j = 0; j < 4; ++j) {
+        for (int i = 0; i < 4; ++i)
+            modelView[j][i] = float(MVM(i, j));
+    }
+    for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 3; ++i)
+            normalMatrix[j][i] = float(NMVM(i, j));
+    }
+}
+
+int RenderQueue::push(const Matrix4& MVM, const Matrix4& NMVM, Material& material, Geometry& geometry) {
+    const Item item = {material.getProgram(), material.getFirstTexture(), &material, &geometry, int(items_.size())};
+    items_.push_back(item);
+    matrices_.push_back(MVM);
+    normalMatrices_.push_back(NMVM);
+    sorted_ = false;
+    return item.order;
+}
+
+void RenderQueue::setMatrix(int draw, const Matrix4& MVM, const Matrix4& NMVM) {
+    matrices_[draw] = MVM;
+    normalMatrices_[draw] = NMVM;
+}
+
+void RenderQueue::clear() {
+    items_.clear();
+    matrices_.clear();
+    normalMatrices_.clear();
+    sorted_ = true;
+}
+
+void RenderQueue::sort() {
+    if (!sorted_)
+        std::sort(items_.begin(), items_.end(), itemLess);
+    sorted_ = true;
+}
+
+void RenderQueue::merge(const RenderQueue& other) {
+    assert(other.sorted_);
+    sort();
+
+    const int offset = matrices_.size();
+    const int middle = items_.size();
+    for (size_t i = 0; i < other.items_.size(); ++i) {
+        items_.push_back(other.items_[i]);
+        items_.back().order += offset;
+    }
+    matrices_.insert(matrices_.end(), other.matrices_.begin(), other.matrices_.end());
+    normalMatrices_.insert(normalMatrices_.end(), other.normalMatrices_.begin(), other.normalMatrices_.end());
+    inplace_merge(items_.begin(), items_.begin() + middle, items_.end(), itemLess);
+}
+
+bool RenderQueue::itemLess(const Item& a, const Item& b) {
+    if (a.program != b.program)
+        return a.program < b.program;
+    if (a.texture != b.texture)
+        return a.texture < b.texture;
+    if (a.material != b.material) {
+        const RenderStates& sa = a.material->getRenderStates();
+        const RenderStates& sb = b.material->getRenderStates();
+        if (sa < sb || sb < sa)
+            return sa < sb;
+        return a.material < b.material;
+    }
+    if (a.geometry != b.geometry)
+        return a.geometry < b.geometry;
+    return a.order < b.order;
+}
+
+void RenderQueue::submit(Uniforms& uniforms) {
+    sort();
+
+    const Stats zero = {0, 0, 0, 0, 0};
+    stats_ = zero;
+
+    const bool instancing = instancingSupported();
+    Material* material = NULL;
+    bool instancedBound = false;
+    GLuint program = 0;
+    Geometry* geometry = NULL;
+    for (int begin = 0, n = items_.size(); begin < n;) {
+        const Item& item = items_[begin];
+        int end = begin + 1;
+        while (end < n && items_[end].material == item.material && items_[end].geometry == item.geometry)
+            ++end;
+
+        const bool instanced = instancing && end - begin >= MIN_INSTANCES && item.material->hasInstancing() &&
+                               item.geometry->isInstanceable();
+
+        if (item.material != material || instanced != instancedBound) {
+            if (geometry)
+                material->unbindGeometry();
+            material = item.material;
+            instancedBound = instanced;
+            material->bind(instanced);
+            geometry = NULL;
+            ++stats_.materialChanges;
+
+            if (material->getProgram(instanced) != program)
+                ++stats_.programChanges;
+            program = material->getProgram(instanced);
+        }
+
+        if (instanced) {
+            if (geometry)
+                material->unbindGeometry();
+            geometry = NULL;
+            drawInstanced(begin, end, uniforms);
+            begin = end;
+            continue;
+        }
+
+        if (item.geometry != geometry) {
+            if (geometry)
+                material->unbindGeometry();
+            geometry = item.geometry;
+            material->bindGeometry(*geometry);
+            ++stats_.geometryChanges;
+        }
+
+        for (int i = begin; i < end; ++i) {
+            sendModelViewNormalMatrix(uniforms, matrices_[items_[i].order], normalMatrices_[items_[i].order]);
+            material->drawBound(uniforms);
+            ++stats_.draws;
+        }
+        begin = end;
+    }
+    if (geometry)
+        material->unbindGeometry();
+}
+
+void RenderQueue::drawInstanced(int begin, int end, Uniforms& uniforms) {
+    instances_.resize(end - begin);
+    for (int i = begin; i < end; ++i)
+        instances_[i - begin].set(matrices_[items_[i].order], normalMatrices_[items_[i].order]);
+
+    if (!instanceVbo_)
+        instanceVbo_.reset(new FormattedVbo(InstanceMatrices::FORMAT));
+    instanceVbo_->upload(&instances_[0], end - begin, true);
+
+    Material& material = *items_[begin].material;
+    material.bindGeometry(*items_[begin].geometry, instanceVbo_.get());
+    material.drawBoundInstanced(end - begin, uniforms);
+    material.unbindGeometry();
+
+    ++stats_.geometryChanges;
+    ++stats_.draws;
+    ++stats_.instancedDraws;
+}
@@ -0,0 +1,128 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "uniforms.h"
+#include "geometry.h"
+#include "material.h"
+
+// True if the current GL context supports instanced drawing with per instance
+// vertex attributes
+bool instancingSupported();
+
+// Per instance vertex attributes read by the instanced vertex shaders, such as
+// shaders/basic-instanced-gl3.vshader: the columns of the model view matrix and
+// of the upper left 3x3 block of the normal matrix
+struct InstanceMatrices {
+    Cvec4f modelView[4];
+    Cvec3f normalMatrix[3];
+
+    static const VertexFormat FORMAT;
+
+    void set(const Matrix4& MVM, const Matrix4& NMVM);
+};
+
+// Collects draws during a traversal and submits them sorted by program, first
+// texture, render states, material and geometry, so that consecutive draws share
+// as much GL state as possible. A program is only made current, a material's
+// uniforms and textures only sent, and a geometry's vertex attributes only set up
+// when they differ from the previous draw's.
+//
+// Runs of at least MIN_INSTANCES draws of the same geometry with the same material
+// become a single instanced draw, if the material has instancing enabled and the
+// geometry supports it. Their matrices go to a per instance attribute buffer.
+//
+// Draws with equal keys keep their submission order. Nothing is sorted by depth,
+// so blended materials are not drawn back to front.
+//
+// Queues can be filled on other threads as command lists: push() and sort() do
+// not touch GL, and the GL thread then merge()s the sorted lists into one queue
+// and flushes it.
+//
+// A queue can also be retained across frames: submit() leaves the draws queued,
+// and setMatrix() moves a single draw without resorting anything.
+class RenderQueue {
+public:
+    // Number of GL state changes made by the last submit()
+    struct Stats {
+        int draws;
+        int programChanges;
+        int materialChanges;
+        int geometryChanges;
+        int instancedDraws;     // instanced draw calls, each counted once in draws
+    };
+
+    static const int MIN_INSTANCES = 2;
+
+    RenderQueue() : sorted_(true) {
+        const Stats zero = {0, 0, 0, 0, 0};
+        stats_ = zero;
+    }
+
+    // Queue a draw of `geometry' with `material' under the model view matrix MVM,
+    // with normal matrix NMVM. Both must stay alive while the draw is queued.
+    // Returns the index of the draw, which is size() before the call.
+    int push(const Matrix4& MVM, const Matrix4& NMVM, Material& material, Geometry& geometry);
+
+    // Change the matrices of a queued draw, given by the index push() returned.
+    // After merge(), the draws of the merged queue have their index plus the
+    // size() of this queue before the merge.
+    void setMatrix(int draw, const Matrix4& MVM, const Matrix4& NMVM);
+
+    int size() const {
+        return items_.size();
+    }
+
+    void clear();
+
+    // Sort the queued draws into submission order
+    void sort();
+
+    // Add the draws of `other', which must be sorted, keeping this queue sorted.
+    // Draws with equal keys from `other' go after those already queued.
+    void merge(const RenderQueue& other);
+
+    // Sort and issue all queued draws. The model view and normal matrices of each
+    // draw are put into `uniforms', which also supplies whatever the materials and
+    // geometries do not.
+    void submit(Uniforms& uniforms);
+
+    // submit(), then empty the queue
+    void flush(Uniforms& uniforms) {
+        submit(uniforms);
+        clear();
+    }
+
+    const Stats& getStats() const {
+        return stats_;
+    }
+
+private:
+    struct Item {
+        GLuint program;
+        const Texture* texture;
+        Material* material;
+        Geometry* geometry;
+        int order;
+    };
+
+    static bool itemLess(const Item& a, const Item& b);
+
+    // Draw items_[begin, end), which share material and geometry, as instances
+    void drawInstanced(int begin, int end, Uniforms& uniforms);
+
+    // Items are sorted, the matrices stay put and are found through Item::order
+    std::vector<Item> items_;
+    std::vector<Matrix4> matrices_, normalMatrices_;
+    bool sorted_;
+    Stats stats_;
+
+    std::vector<InstanceMatrices> instances_;
+    std::shared_ptr<FormattedVbo> instanceVbo_;
+};
+
+#endif
@@ -117,6 +117,20 @@ void RenderStates::apply() const {
     }
 }
 
+bool RenderStates::operator<(const RenderStates& other) const {
+    if (flags != other.flags)
+        return flags < other.flags;
+    if (glBlendSrcFactor != other.glBlendSrcFactor)
+        return glBlendSrcFactor < other.glBlendSrcFactor;
+    if (glBlendDstFactor != other.glBlendDstFactor)
+        return glBlendDstFactor < other.glBlendDstFactor;
+    if (glCullFaceMode != other.glCullFaceMode)
+        return glCullFaceMode < other.glCullFaceMode;
+    if (glFront != other.glFront)
+        return glFront < other.glFront;
+    return glBack < other.glBack;
+}
+
 void RenderStates::captureFromGl() {
     GLint values[2];
 
@@ -35,6 +35,9 @@ public:
 
     void apply() const;
 
+    // Strict weak ordering, so that draws can be sorted to group identical states
+    bool operator<(const RenderStates& other) const;
+
     void captureFromGl();
 };
 
@@ -79,4 +79,11 @@ inline Matrix4 rigTFormToMatrix(const RigTForm &rbt) {
     return T * R;
 }
 
+// normalMatrix(rigTFormToMatrix(rbt) * A), given normalAffine = normalMatrix(A).
+// The inverse transpose of a rotation is the rotation itself, and translations
+// drop out, so this takes no inversion.
+inline Matrix4 normalMatrix(const RigTForm &rbt, const Matrix4 &normalAffine) {
+    return quatToMatrix(rbt.getRotation()) * normalAffine;
+}
+
 #endif
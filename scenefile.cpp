@@ -0,0 +1,347 @@
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "nodepool.h"
+#include "scenefile.h"
+
+using namespace std;
+
+static const char MAGIC[4] = {'S', 'G', 'S', 'F'};
+static const uint32_t VERSION = 1;
+static const uint32_t NO_NAME = ~uint32_t(0);
+
+enum NodeKind {
+    KIND_ROOT = 0,
+    KIND_RBT = 1,
+    KIND_SHAPE = 2
+};
+
+enum NodeFlags {
+    FLAG_STATIC = 1
+};
+
+//----------------------------------
+// SceneCatalog
+//----------------------------------
+
+shared_ptr<Geometry> SceneCatalog::findGeometry(const string& name) const {
+    const map<string, shared_ptr<Geometry> >::const_iterator i = geometries_.find(name);
+    return i == geometries_.end() ? shared_ptr<Geometry>() : i->second;
+}
+
+shared_ptr<Material> SceneCatalog::findMaterial(const string& name) const {
+    const map<string, shared_ptr<Material> >::const_iterator i = materials_.find(name);
+    return i == materials_.end() ? shared_ptr<Material>() : i->second;
+}
+
+const string* SceneCatalog::getName(const Geometry* geometry) const {
+    const map<const Geometry*, string>::const_iterator i = geometryNames_.find(geometry);
+    return i == geometryNames_.end() ? NULL : &i->second;
+}
+
+const string* SceneCatalog::getName(const Material* material) const {
+    const map<const Material*, string>::const_iterator i = materialNames_.find(material);
+    return i == materialNames_.end() ? NULL : &i->second;
+}
+
+//----------------------------------
+// Saving
+//----------------------------------
+
+template<typename T>
+static void put(vector<char>& out, const T& value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Writes the node records, and collects the names they refer to
+class SceneWriter : public SgNodeVisitor {
+public:
+    explicit SceneWriter(const SceneCatalog& catalog) : numNodes(0), catalog_(catalog) {}
+
+    vector<char> records;
+    int numNodes;
+    vector<const string*> geometryNames, materialNames;
+
+    virtual bool visit(SgTransformNode& node) {
+        const bool isRoot = numNodes == 0 && dynamic_cast<SgRootNode*>(&node) != NULL;
+        putHeader(isRoot ? KIND_ROOT : KIND_RBT, node.isStatic() ? FLAG_STATIC : 0);
+        if (!isRoot) {
+            const RigTForm rbt = node.getRbt();
+            const Cvec3 t = rbt.getTranslation();
+            const Quat q = rbt.getRotation();
+            const double values[7] = {t[0], t[1], t[2], q[0], q[1], q[2], q[3]};
+            put(records, values);
+        }
+        parents_.push_back(numNodes++);
+        return true;
+    }
+
+    virtual bool postVisit(SgTransformNode& node) {
+        parents_.pop_back();
+        return true;
+    }
+
+    virtual bool visit(SgShapeNode& node) {
+        SgGeometryShapeNode* shape = dynamic_cast<SgGeometryShapeNode*>(&node);
+        if (!shape)
+            throw runtime_error("saveScene: only SgGeometryShapeNodes can be saved");
+        putHeader(KIND_SHAPE, 0);
+        put(records, nameIndex(catalog_.getName(shape->geometry.get()), geometryIndices_, geometryNames));
+        put(records, nameIndex(catalog_.getName(shape->material.get()), materialIndices_, materialNames));
+        put(records, shape->overridingMaterial && !catalog_.isOverridingOmitted(shape->overridingMaterial.get())
+                     ? nameIndex(catalog_.getName(shape->overridingMaterial.get()), materialIndices_, materialNames)
+                     : NO_NAME);
+        double affine[12];
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 4; ++c)
+                affine[4 * r + c] = shape->affineMatrix(r, c);
+        }
+        put(records, affine);
+        ++numNodes;
+        return true;
+    }
+
+private:
+    const SceneCatalog& catalog_;
+    vector<int> parents_;
+    map<const string*, uint32_t> geometryIndices_, materialIndices_;
+
+    void putHeader(uint8_t kind, uint8_t flags) {
+        put(records, kind);
+        put(records, flags);
+        put(records, uint16_t(0));
+        put(records, int32_t(parents_.empty() ? -1 : parents_.back()));
+    }
+
+    static uint32_t nameIndex(const string* name, map<const string*, uint32_t>& indices, vector<const string*>& names) {
+        if (!name)
+            throw runtime_error("saveScene: a shape uses a resource missing from the catalog");
+        const map<const string*, uint32_t>::iterator i = indices.find(name);
+        if (i != indices.end())
+            return i->second;
+        indices[name] = names.size();
+        names.push_back(name);
+        return names.size() - 1;
+    }
+};
+
+void saveScene(const string& filename, SgTransformNode& root, const SceneCatalog& catalog) {
+    SceneWriter writer(catalog);
+    root.accept(writer);
+
+    vector<char> out;
+    out.insert(out.end(), MAGIC, MAGIC + 4);
+    put(out, VERSION);
+    put(out, uint32_t(writer.numNodes));
+    put(out, uint32_t(writer.geometryNames.size()));
+    put(out, uint32_t(writer.materialNames.size()));
+    put(out, uint32_t(0));
+    for (int k = 0; k < 2; ++k) {
+        const vector<const string*>& names = k == 0 ? writer.geometryNames : writer.materialNames;
+        for (size_t i = 0; i < names.size(); ++i) {
+            put(out, uint32_t(names[i]->size()));
+            out.insert(out.end(), names[i]->begin(), names[i]->end());
+        }
+    }
+    out.insert(out.end(), writer.records.begin(), writer.records.end());
+
+    ofstream f(filename.c_str(), ios::binary);
+    if (!f)
+        throw runtime_error("Cannot open file " + filename);
+    f.write(&out[0], out.size());
+    if (!f)
+        throw runtime_error("Cannot write file " + filename);
+}
+
+//----------------------------------
+// Loading
+//----------------------------------
+
+// The contents of a file, mapped into memory where mmap is available and read
+// into a buffer elsewhere
+class MappedFile : Noncopyable {
+public:
+    explicit MappedFile(const string& filename) : data_(NULL), size_(0) {
+#ifndef _WIN32
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw runtime_error("Cannot open file " + filename);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(p);
+                size_ = st.st_size;
+            }
+        }
+        close(fd);
+        if (data_)
+            return;
+#endif
+        ifstream f(filename.c_str(), ios::binary);
+        if (!f)
+            throw runtime_error("Cannot open file " + filename);
+        buffer_.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        size_ = buffer_.size();
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    const char* data() const {
+        return data_ ? data_ : buffer_.data();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char* data_;      // the mapping, NULL if buffer_ is used
+    size_t size_;
+    vector<char> buffer_;
+};
+
+// Bounds checked reads from the file
+class SceneReader {
+public:
+    SceneReader(const char* begin, const char* end) : p_(begin), end_(end) {}
+
+    template<typename T>
+    T get() {
+        T value;
+        getBytes(&value, sizeof(T));
+        return value;
+    }
+
+    void getBytes(void* out, size_t n) {
+        if (size_t(end_ - p_) < n)
+            throw runtime_error("loadScene: file is truncated");
+        memcpy(out, p_, n);
+        p_ += n;
+    }
+
+    // Throw unless `count' items of at least `size' bytes each could still follow
+    void checkCount(uint64_t count, size_t size) const {
+        if (size_t(end_ - p_) / size < count)
+            throw runtime_error("loadScene: file is truncated");
+    }
+
+    string getString() {
+        const uint32_t length = get<uint32_t>();
+        if (size_t(end_ - p_) < length)
+            throw runtime_error("loadScene: file is truncated");
+        const string s(p_, length);
+        p_ += length;
+        return s;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+shared_ptr<SgTransformNode> loadScene(const string& filename, const SceneCatalog& catalog) {
+    const MappedFile file(filename);
+    SceneReader in(file.data(), file.data() + file.size());
+
+    char magic[4];
+    in.getBytes(magic, 4);
+    if (memcmp(magic, MAGIC, 4) != 0 || in.get<uint32_t>() != VERSION)
+        throw runtime_error("loadScene: " + filename + " is not a scene file of version 1");
+    const uint32_t numNodes = in.get<uint32_t>();
+    const uint32_t numGeometries = in.get<uint32_t>();
+    const uint32_t numMaterials = in.get<uint32_t>();
+    in.get<uint32_t>();
+    // names take at least their length, records their header, so the counts
+    // are checked before anything is allocated for them
+    in.checkCount(uint64_t(numGeometries) + numMaterials, sizeof(uint32_t));
+    in.checkCount(numNodes, 2 * sizeof(uint32_t));
+    vector<shared_ptr<Geometry> > geometries(numGeometries);
+    vector<shared_ptr<Material> > materials(numMaterials);
+    for (size_t i = 0; i < geometries.size(); ++i) {
+        const string name = in.getString();
+        if (!(geometries[i] = catalog.findGeometry(name)))
+            throw runtime_error("loadScene: no geometry named " + name);
+    }
+    for (size_t i = 0; i < materials.size(); ++i) {
+        const string name = in.getString();
+        if (!(materials[i] = catalog.findMaterial(name)))
+            throw runtime_error("loadScene: no material named " + name);
+    }
+
+    shared_ptr<SgTransformNode> root;
+    vector<SgTransformNode*> transforms(numNodes, NULL);    // by record, NULL for shapes
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        const uint8_t kind = in.get<uint8_t>();
+        const uint8_t flags = in.get<uint8_t>();
+        in.get<uint16_t>();
+        const int32_t parent = in.get<int32_t>();
+        if (i == 0 ? parent != -1 || kind == KIND_SHAPE : parent < 0 || uint32_t(parent) >= i || !transforms[parent])
+            throw runtime_error("loadScene: invalid node hierarchy");
+
+        shared_ptr<SgNode> node;
+        if (kind == KIND_ROOT && i == 0) {
+            root = makePooledNode<SgRootNode>();
+            node = root;
+        }
+        else if (kind == KIND_RBT) {
+            double v[7];
+            in.getBytes(v, sizeof(v));
+            const shared_ptr<SgRbtNode> rbtNode =
+                    makePooledNode<SgRbtNode>(RigTForm(Cvec3(v[0], v[1], v[2]), Quat(v[3], v[4], v[5], v[6])));
+            if (i == 0)
+                root = rbtNode;
+            node = rbtNode;
+        }
+        else if (kind == KIND_SHAPE) {
+            const uint32_t geometry = in.get<uint32_t>();
+            const uint32_t material = in.get<uint32_t>();
+            const uint32_t overriding = in.get<uint32_t>();
+            if (geometry >= geometries.size() || material >= materials.size() ||
+                (overriding != NO_NAME && overriding >= materials.size()))
+                throw runtime_error("loadScene: invalid resource index");
+            double affine[12];
+            in.getBytes(affine, sizeof(affine));
+            const shared_ptr<SgGeometryShapeNode> shape =
+                    makePooledNode<SgGeometryShapeNode>(geometries[geometry], materials[material]);
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 4; ++c)
+                    shape->affineMatrix(r, c) = affine[4 * r + c];
+            }
+            if (overriding != NO_NAME)
+                shape->overridingMaterial = materials[overriding];
+            node = shape;
+        }
+        else
+            throw runtime_error("loadScene: invalid node kind");
+
+        if (kind != KIND_SHAPE) {
+            transforms[i] = static_cast<SgTransformNode*>(node.get());
+            if (flags & FLAG_STATIC)
+                transforms[i]->setStatic(true);
+        }
+        if (i > 0)
+            transforms[parent]->addChild(node);
+    }
+    if (!root)
+        throw runtime_error("loadScene: " + filename + " holds no nodes");
+    return root;
+}
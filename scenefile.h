@@ -0,0 +1,90 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <map>
+#include <set>
+#include <memory>
+#include <string>
+
+#include "geometry.h"
+#include "material.h"
+#include "scenegraph.h"
+
+// Scene files are binary snapshots of a scene graph: its hierarchy, the rbts of
+// its transform nodes and the affine matrices of its SgGeometryShapeNodes.
+// Geometries and materials are not stored, only their names in a SceneCatalog,
+// which the program fills with the same resources when saving and loading.
+//
+// Layout, in the byte order of the machine that wrote it:
+//
+//   header:  "SGSF", uint32 version, uint32 numNodes,
+//            uint32 numGeometries, uint32 numMaterials, uint32 reserved
+//   names:   numGeometries then numMaterials times uint32 length, chars
+//   nodes:   numNodes records in pre-order, each
+//              uint8 kind, uint8 flags, uint16 reserved, int32 parent
+//            followed by, for an rbt node, its translation and rotation as
+//            double x, y, z, qw, qx, qy, qz, and for a shape uint32 geometry,
+//            material and overriding material name indices (~0 for none) and
+//            the top three rows of its affine matrix as 12 doubles
+//
+// The parent of a record is the index of an earlier record, so loadScene()
+// builds the graph in one pass over the file, which it maps into memory. The
+// nodes are made by makePooledNode(), so they land next to each other in their
+// NodePools.
+
+// The geometries and materials a scene file may refer to, by name
+class SceneCatalog {
+public:
+    SceneCatalog& add(const std::string& name, const std::shared_ptr<Geometry>& geometry) {
+        geometries_[name] = geometry;
+        geometryNames_[geometry.get()] = name;
+        return *this;
+    }
+
+    SceneCatalog& add(const std::string& name, const std::shared_ptr<Material>& material) {
+        materials_[name] = material;
+        materialNames_[material.get()] = name;
+        return *this;
+    }
+
+    // Save shapes overridden by `material' as not overridden, e.g., when the
+    // material only fits geometries saved under the name of another one
+    SceneCatalog& omitOverriding(const std::shared_ptr<Material>& material) {
+        omittedOverriding_.insert(material.get());
+        return *this;
+    }
+
+    bool isOverridingOmitted(const Material* material) const {
+        return omittedOverriding_.count(material) > 0;
+    }
+
+    // NULL if there is none of that name
+    std::shared_ptr<Geometry> findGeometry(const std::string& name) const;
+
+    std::shared_ptr<Material> findMaterial(const std::string& name) const;
+
+    // Name of a resource, NULL if it is not in the catalog
+    const std::string* getName(const Geometry* geometry) const;
+
+    const std::string* getName(const Material* material) const;
+
+private:
+    std::map<std::string, std::shared_ptr<Geometry> > geometries_;
+    std::map<std::string, std::shared_ptr<Material> > materials_;
+    std::map<const Geometry*, std::string> geometryNames_;
+    std::map<const Material*, std::string> materialNames_;
+    std::set<const Material*> omittedOverriding_;
+};
+
+// Write `root' and its subtree. A SgRootNode at the top is saved as such, every
+// other transform node as a SgRbtNode with its current getRbt(), and the static
+// flags are kept. Throws runtime_error if the file cannot be written, or a shape
+// is not a SgGeometryShapeNode or uses a resource missing from the catalog.
+void saveScene(const std::string& filename, SgTransformNode& root, const SceneCatalog& catalog);
+
+// Build the scene saved in a file. Throws runtime_error if the file cannot be
+// read, is not a scene file of this version, or names a resource missing from
+// the catalog.
+std::shared_ptr<SgTransformNode> loadScene(const std::string& filename, const SceneCatalog& catalog);
+
+#endif
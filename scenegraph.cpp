@@ -4,70 +4,196 @@
 
 using namespace std;
 
+unsigned long SgNode::changeVersion_ = 0;
+
+SgChangeList* SgNode::firstChangeList_ = NULL;
+
+unsigned long SgTransformNode::structureVersion_ = 0;
+
+SgTransformNode::~SgTransformNode() {
+    if (!children_.empty())
+        ++structureVersion_;
+    for (int i = 0, n = children_.size(); i < n; ++i) {
+        SgNode* child = children_[i].get();
+        child->parent_ = NULL;
+        if (SgTransformNode* transformChild = dynamic_cast<SgTransformNode*>(child))
+            transformChild->invalidateWorldRbt();
+    }
+}
+
 bool SgTransformNode::accept(SgNodeVisitor& visitor) {
     if (!visitor.visit(*this))
         return false;
-    for (int i = 0, n = children_.size(); i < n; ++i) {
-        if (!children_[i]->accept(visitor))
-            return false;
+    if (visitor.visitChildren(*this)) {
+        for (int i = 0, n = children_.size(); i < n; ++i) {
+            if (!children_[i]->accept(visitor))
+                return false;
+        }
     }
     return visitor.postVisit(*this);
 }
 
+SgNode::~SgNode() {
+    for (SgChangeList* list = firstChangeList_; list; list = list->next_)
+        list->forget(this);
+}
+
+void SgNode::reportChange(int changes) {
+    for (SgChangeList* list = firstChangeList_; list; list = list->next_)
+        list->record(this, changes);
+}
+
+void SgNode::invalidateBounds(int changes) {
+    noteChange(changes);
+    for (SgTransformNode* node = parent_; node && !node->boundsDirty_; node = node->parent_)
+        node->boundsDirty_ = true;
+}
+
 void SgTransformNode::addChild(shared_ptr<SgNode> child) {
+    if (child->parent_)
+        throw runtime_error("SgTransformNode::addChild: the node already has a parent");
     children_.push_back(child);
+    child->parent_ = this;
+    ++structureVersion_;
+    noteChange(CHANGE_STRUCTURE);
+    child->invalidateBounds(CHANGE_STRUCTURE);
+    if (SgTransformNode* transformChild = dynamic_cast<SgTransformNode*>(child.get()))
+        transformChild->invalidateWorldRbt();
 }
 
 void SgTransformNode::removeChild(shared_ptr<SgNode> child) {
-    children_.erase(find(children_.begin(), children_.end(), child));
+    const vector<shared_ptr<SgNode> >::iterator i = find(children_.begin(), children_.end(), child);
+    if (i == children_.end())
+        throw runtime_error("SgTransformNode::removeChild: not a child of this node");
+    child->invalidateBounds(CHANGE_STRUCTURE);
+    children_.erase(i);
+    child->parent_ = NULL;
+    ++structureVersion_;
+    noteChange(CHANGE_STRUCTURE);
+    if (SgTransformNode* transformChild = dynamic_cast<SgTransformNode*>(child.get()))
+        transformChild->invalidateWorldRbt();
 }
 
-bool SgShapeNode::accept(SgNodeVisitor& visitor) {
-    if (!visitor.visit(*this))
-        return false;
-    return visitor.postVisit(*this);
+const RigTForm& SgTransformNode::getWorldRbt() {
+    if (worldRbtDirty_) {
+        SgTransformNode* parent = getParent();
+        worldRbt_ = parent ? parent->getWorldRbt() * getRbt() : getRbt();
+        worldRbtDirty_ = false;
+    }
+    return worldRbt_;
+}
+
+const Bounds& SgTransformNode::getSubtreeBounds() {
+    if (boundsDirty_) {
+        bounds_ = Bounds();
+        for (int i = 0, n = children_.size(); i < n; ++i) {
+            SgNode* child = children_[i].get();
+            if (SgTransformNode* transformChild = dynamic_cast<SgTransformNode*>(child))
+                bounds_.extend(transformChild->getSubtreeBounds().transformed(rigTFormToMatrix(transformChild->getRbt())));
+            else if (SgShapeNode* shapeChild = dynamic_cast<SgShapeNode*>(child))
+                bounds_.extend(shapeChild->getBounds());
+        }
+        boundsDirty_ = false;
+    }
+    return bounds_;
 }
 
-class RbtAccumVisitor : public SgNodeVisitor {
-protected:
-    vector<RigTForm> rbtStack_;
-    SgTransformNode& target_;
-    bool found_;
-public:
-    RbtAccumVisitor(SgTransformNode& target)
-            : target_(target), found_(false) {}
+void SgTransformNode::setStatic(bool isStatic) {
+    if (static_ != isStatic) {
+        static_ = isStatic;
+        ++structureVersion_;
+        noteChange(CHANGE_STRUCTURE);
+    }
+}
 
-    const RigTForm getAccumulatedRbt(int offsetFromStackTop = 0) {
-        if (!found_)
-            throw runtime_error("RbtAccumVisitor target never reached");
-        return rbtStack_[rbtStack_.size() - 1 - offsetFromStackTop];
+void SgTransformNode::invalidateWorldRbt() {
+    if (worldRbtDirty_)
+        return;
+    worldRbtDirty_ = true;
+    for (int i = 0, n = children_.size(); i < n; ++i) {
+        if (SgTransformNode* transformChild = dynamic_cast<SgTransformNode*>(children_[i].get()))
+            transformChild->invalidateWorldRbt();
     }
+}
 
-    virtual bool visit(SgTransformNode& node) {
-        if (rbtStack_.empty())
-            rbtStack_.push_back(RigTForm());
-        else
-            rbtStack_.push_back(rbtStack_.back() * node.getRbt());
+SgChangeList::SgChangeList() : prev_(NULL), next_(SgNode::firstChangeList_) {
+    if (next_)
+        next_->prev_ = this;
+    SgNode::firstChangeList_ = this;
+}
 
-        if (target_ == node) {
-            found_ = true;
-            return false;
-        }
-        return true;
+SgChangeList::~SgChangeList() {
+    (prev_ ? prev_->next_ : SgNode::firstChangeList_) = next_;
+    if (next_)
+        next_->prev_ = prev_;
+}
+
+int SgChangeList::getChanges(const SgNode* node) const {
+    const unordered_map<const SgNode*, int>::const_iterator i = indices_.find(node);
+    return i == indices_.end() ? 0 : entries_[i->second].changes;
+}
+
+void SgChangeList::clear() {
+    entries_.clear();
+    indices_.clear();
+}
+
+void SgChangeList::record(SgNode* node, int changes) {
+    const pair<unordered_map<const SgNode*, int>::iterator, bool> i = indices_.insert(make_pair(node, int(entries_.size())));
+    if (i.second) {
+        const Entry entry = {node, changes};
+        entries_.push_back(entry);
     }
+    else
+        entries_[i.first->second].changes |= changes;
+}
 
-    virtual bool postVisit(SgTransformNode& node) {
-        rbtStack_.pop_back();
-        return true;
+void SgChangeList::forget(const SgNode* node) {
+    const unordered_map<const SgNode*, int>::iterator i = indices_.find(node);
+    if (i == indices_.end())
+        return;
+    // move the last entry into the hole
+    const int index = i->second;
+    indices_.erase(i);
+    if (index != int(entries_.size()) - 1) {
+        entries_[index] = entries_.back();
+        indices_[entries_[index].node] = index;
     }
-};
+    entries_.pop_back();
+}
+
+bool SgShapeNode::accept(SgNodeVisitor& visitor) {
+    if (!visitor.visit(*this))
+        return false;
+    return visitor.postVisit(*this);
+}
 
 RigTForm getPathAccumRbt(
         SgTransformNode* source,
         SgTransformNode* destination,
         int offsetFromDestination) {
 
-    RbtAccumVisitor accum(*destination);
-    source->accept(accum);
-    return accum.getAccumulatedRbt(offsetFromDestination);
+    SgTransformNode* node = destination;
+    for (int i = 0; i < offsetFromDestination && node; ++i)
+        node = node->getParent();
+
+    // The cached world rbts start at the root, so use them when source is one
+    // (always the case for g_world). They include the rbt of the root, the path
+    // accumulation does not.
+    if (source->getParent() == NULL) {
+        SgTransformNode* root = node;
+        while (root && root->getParent())
+            root = root->getParent();
+        if (root != source)
+            throw runtime_error("getPathAccumRbt: destination not found under source");
+        return inv(source->getRbt()) * node->getWorldRbt();
+    }
+
+    RigTForm accum;
+    for (; node != source; node = node->getParent()) {
+        if (node == NULL)
+            throw runtime_error("getPathAccumRbt: destination not found under source");
+        accum = node->getRbt() * accum;
+    }
+    return accum;
 }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include <stdexcept>
 
 #include "matrix4.h"
@@ -10,15 +11,28 @@
 #include "glsupport.h" // for Noncopyable
 #include "uniforms.h"
 #include "geometry.h"
+#include "bounds.h"
+#include "renderqueue.h"
 #include "asstcommon.h"
 
 class SgNodeVisitor;
 
+class SgTransformNode;
+
+class SgChangeList;
+
 class SgNode : public std::enable_shared_from_this<SgNode>, Noncopyable {
 public:
     virtual bool accept(SgNodeVisitor& vistor) = 0;
 
-    virtual ~SgNode() {}
+    virtual ~SgNode();
+
+    // Kinds of changes, as reported to SgChangeLists
+    enum Change {
+        CHANGE_RBT = 1,         // the rbt of a transform node
+        CHANGE_STRUCTURE = 2,   // the children or the parent of a node, or a static flag
+        CHANGE_CONTENT = 4      // anything else: bounds, geometry, material, ...
+    };
 
     // Two nodes are equal if and only if they're the same, i.e.,
     // having the same in memory address
@@ -30,8 +44,64 @@ public:
         return !(*this == other);
     }
 
+    // The transform node this node is a child of, NULL if it is not in a tree or
+    // is the root. A node has at most one parent.
+    SgTransformNode* getParent() const {
+        return parent_;
+    }
+
+    // Must be called when the bounds of this node, in its parent's frame, change
+    // (for a shape, when its geometry or affine matrix changed). Marks the cached
+    // subtree bounds of all its ancestors as stale, and counts as a change (see
+    // markChanged()).
+    void invalidateBounds() {
+        invalidateBounds(CHANGE_CONTENT);
+    }
+
+    // Must be called when something drawn changes that leaves the bounds alone,
+    // e.g., the material of a shape. Stamps the node with a new change version, so
+    // that retained data such as FlatScene's command lists gets refreshed.
+    void markChanged() {
+        noteChange(CHANGE_CONTENT);
+    }
+
+    // Change version of the last change to this node: of its rbt, its bounds, or
+    // through markChanged()
+    unsigned long getChangeStamp() const {
+        return changeStamp_;
+    }
+
+    // Incremented by every change to any node, so nodes stamped after a given
+    // version are exactly those changed since
+    static unsigned long getChangeVersion() {
+        return changeVersion_;
+    }
+
 protected:
-    SgNode() {}
+    SgNode() : parent_(NULL), changeStamp_(0) {}
+
+    // Stamp the node with a new change version and report the change to the
+    // SgChangeLists
+    void noteChange(int changes) {
+        changeStamp_ = ++changeVersion_;
+        if (firstChangeList_)
+            reportChange(changes);
+    }
+
+    // invalidateBounds(), reporting the given changes
+    void invalidateBounds(int changes);
+
+private:
+    friend class SgTransformNode; // maintains parent_ in addChild/removeChild
+    friend class SgChangeList;    // maintains the list of lists
+
+    static unsigned long changeVersion_;
+    static SgChangeList* firstChangeList_;
+
+    void reportChange(int changes);
+
+    SgTransformNode* parent_;
+    unsigned long changeStamp_;
 };
 
 //
@@ -41,24 +111,77 @@ protected:
 //
 class SgTransformNode : public SgNode {
 public:
+    // Children still held elsewhere become roots of their own trees
+    virtual ~SgTransformNode();
+
     virtual bool accept(SgNodeVisitor& visitor);
 
     virtual RigTForm getRbt() = 0;
 
+    // Throws runtime_error if the child already has a parent
     void addChild(std::shared_ptr<SgNode> child);
 
+    // Throws runtime_error if the child is not a child of this node
     void removeChild(std::shared_ptr<SgNode> child);
 
     int getNumChildren() const {
         return children_.size();
     }
 
-    std::shared_ptr<SgNode> getChild(int i) {
+    const std::shared_ptr<SgNode>& getChild(int i) const {
         return children_[i];
     }
 
+    // Incremented by every addChild/removeChild/setStatic on any node. Lets
+    // derived data structures such as FlatScene notice that some hierarchy changed.
+    static unsigned long getStructureVersion() {
+        return structureVersion_;
+    }
+
+    // Accumulated rbt from the root of the tree down to and including this node,
+    // i.e., the product of getRbt() along the path. Cached, and only recomputed
+    // after an rbt above it changed.
+    const RigTForm& getWorldRbt();
+
+    // Bounds of everything below this node, in this node's frame (i.e., not
+    // including its own rbt). Cached until invalidateBounds() is called on a node
+    // of the subtree, or the children change.
+    const Bounds& getSubtreeBounds();
+
+    // Flag this node and its subtree as static: expected to rarely move or
+    // change, in the world as well as relative to each other. Renderers such as
+    // FlatScene may then bake their shapes together (see StaticBatch), which
+    // makes editing them slow. Counts as a change of the hierarchy.
+    void setStatic(bool isStatic);
+
+    // Whether setStatic(true) was called on this node, not on an ancestor
+    bool isStatic() const {
+        return static_;
+    }
+
+protected:
+    SgTransformNode() : worldRbtDirty_(true), boundsDirty_(true), static_(false) {}
+
+    // Must be called whenever getRbt() changes. Marks the cached world rbts of
+    // this node and its whole subtree as stale.
+    void invalidateWorldRbt();
+
 private:
+    static unsigned long structureVersion_;
+
     std::vector<std::shared_ptr<SgNode> > children_;
+
+    // Invariant: if a node's world rbt is dirty, so are those of all its descendants.
+    // This lets invalidateWorldRbt() stop at nodes that are already dirty.
+    RigTForm worldRbt_;
+    bool worldRbtDirty_;
+
+    // Invariant: if a node's subtree bounds are dirty, so are those of its ancestors
+    friend class SgNode;
+    Bounds bounds_;
+    bool boundsDirty_;
+
+    bool static_;
 };
 
 //
@@ -71,7 +194,79 @@ public:
 
     virtual Matrix4 getAffineMatrix() = 0;
 
-    virtual void draw(const Uniforms& uniforms) = 0;
+    // normalMatrix(getAffineMatrix()), to be combined with the rotation of the
+    // accumulated rbt by normalMatrix(const RigTForm&, const Matrix4&)
+    virtual Matrix4 getNormalAffineMatrix() {
+        return normalMatrix(getAffineMatrix());
+    }
+
+    // Issue the drawing, with MVM the full model view matrix (including
+    // getAffineMatrix()) and NMVM its normal matrix. Shapes made of several parts,
+    // such as SgSkeletonNode, derive the matrices of each part from them.
+    virtual void draw(Uniforms& uniforms, const Matrix4& MVM, const Matrix4& NMVM) = 0;
+
+    // Queue the draws instead of issuing them, with matrices as for draw(). Pushes
+    // one or more draws in a row, or returns false if the shape can only be drawn
+    // through draw().
+    virtual bool enqueue(RenderQueue& queue, const Matrix4& MVM, const Matrix4& NMVM) { return false; }
+
+    // Move the draws enqueue() pushed, the first of which is `draw', to new
+    // matrices. Only valid while nothing but the matrices changed.
+    virtual void requeue(RenderQueue& queue, int draw, const Matrix4& MVM, const Matrix4& NMVM) {
+        queue.setMatrix(draw, MVM, NMVM);
+    }
+
+    // Bounds of the drawn shape in the parent's frame. Infinite unless overridden
+    virtual Bounds getBounds() {
+        return Bounds::infinite();
+    }
+};
+
+
+// The nodes changed since the last clear(), each listed once with all the kinds
+// of changes it went through (see SgNode::Change), in no particular order. It
+// lets consumers of the scene graph, such as FlatScene, refresh exactly what
+// changed between two frames instead of checking every node.
+//
+// A list hears about the changes to every node while it exists, whatever tree
+// the node is in; nodes drop out of it when they are destroyed. Changes to the
+// hierarchy are reported on the parent as well as on the child. Like the scene
+// graph, lists are not thread safe: the nodes must be edited on the thread that
+// reads the lists.
+class SgChangeList : Noncopyable {
+public:
+    struct Entry {
+        SgNode* node;
+        int changes;    // SgNode::Change flags
+    };
+
+    SgChangeList();
+
+    ~SgChangeList();
+
+    const std::vector<Entry>& getEntries() const {
+        return entries_;
+    }
+
+    bool isEmpty() const {
+        return entries_.empty();
+    }
+
+    // Changes to a node since the last clear(), 0 if none
+    int getChanges(const SgNode* node) const;
+
+    void clear();
+
+private:
+    friend class SgNode;
+
+    std::vector<Entry> entries_;
+    std::unordered_map<const SgNode*, int> indices_;    // index of each node's entry
+    SgChangeList* prev_, * next_;   // in the list of lists that starts at SgNode::firstChangeList_
+
+    void record(SgNode* node, int changes);
+
+    void forget(const SgNode* node);
 };
 
 
@@ -82,6 +277,10 @@ class SgNodeVisitor {
 public:
     virtual bool visit(SgTransformNode& node) { return true; }
 
+    // Called after visit(SgTransformNode&). Returning false skips the children of
+    // the node, but postVisit is still called, e.g., for culling.
+    virtual bool visitChildren(SgTransformNode& node) { return true; }
+
     virtual bool visit(SgShapeNode& node) { return true; }
 
     virtual bool postVisit(SgTransformNode& node) { return true; }
@@ -90,6 +289,12 @@ public:
 };
 
 
+// Accumulated rbt from source (exclusive) to destination (inclusive), where
+// destination must be a descendant of source. With offsetFromDestination = k, the
+// accumulation stops at the k-th ancestor of destination instead, e.g., k = 1 gives
+// the frame of destination's parent. Walks up the parent links, so this takes
+// O(depth of destination). Throws runtime_error if destination is not found under
+// source, or has less than k ancestors below it.
 RigTForm getPathAccumRbt(
         SgTransformNode* source,
         SgTransformNode* destination,
@@ -122,6 +327,8 @@ public:
 
     void setRbt(const RigTForm& rbt) {
         rbt_ = rbt;
+        invalidateWorldRbt();
+        invalidateBounds(CHANGE_RBT);
     }
 
 private:
@@ -134,6 +341,10 @@ public:
     std::shared_ptr<Material> material;
     Matrix4 affineMatrix;
 
+    // Used instead of g_overridingMaterial when one is set, for geometries whose
+    // vertex attributes the overriding material's shaders cannot consume
+    std::shared_ptr<Material> overridingMaterial;
+
     SgGeometryShapeNode(std::shared_ptr<Geometry> _geometry,
                         std::shared_ptr<Material> _material,
                         const Cvec3& translation = Cvec3(0, 0, 0),
@@ -144,10 +355,25 @@ public:
                            Matrix4::makeXRotation(eulerAngles[0]) *
                            Matrix4::makeYRotation(eulerAngles[1]) *
                            Matrix4::makeZRotation(eulerAngles[2]) *
-                           Matrix4::makeScale(scales)) {}
+                           Matrix4::makeScale(scales)),
+              cacheStamp_(-1) {}
 
     virtual Matrix4 getAffineMatrix() {
-        return affineMatrix;
+        updateAffineCache();
+        return affine_;
+    }
+
+    virtual Matrix4 getNormalAffineMatrix() {
+        updateAffineCache();
+        return normalAffine_;
+    }
+
+    // If geometry or affineMatrix are assigned directly, or the geometry is
+    // uploaded again, call invalidateBounds() afterwards. If only the materials
+    // are, call markChanged().
+    virtual Bounds getBounds() {
+        const Bounds* bounds = geometry->getBounds();
+        return bounds ? bounds->transformed(getAffineMatrix()) : Bounds::infinite();
     }
 
     void setAffineMatrix(const Cvec3& translation = Cvec3(0, 0, 0),
@@ -158,13 +384,40 @@ public:
                        Matrix4::makeYRotation(eulerAngles[1]) *
                        Matrix4::makeZRotation(eulerAngles[2]) *
                        Matrix4::makeScale(scales);
+        invalidateBounds();
     }
 
-    virtual void draw(const Uniforms& uniforms) {
+    // The material draw() and enqueue() use
+    Material& getDrawMaterial() const {
         if (g_overridingMaterial)
-            g_overridingMaterial->draw(*geometry, uniforms);
-        else
-            material->draw(*geometry, uniforms);
+            return *(overridingMaterial ? overridingMaterial : g_overridingMaterial);
+        return *material;
+    }
+
+    virtual void draw(Uniforms& uniforms, const Matrix4& MVM, const Matrix4& NMVM) {
+        sendModelViewNormalMatrix(uniforms, MVM, NMVM);
+        getDrawMaterial().draw(*geometry, uniforms);
+    }
+
+    virtual bool enqueue(RenderQueue& queue, const Matrix4& MVM, const Matrix4& NMVM) {
+        queue.push(MVM, NMVM, getDrawMaterial(), *geometry);
+        return true;
+    }
+
+private:
+    // affineMatrix with the geometry's position decode, and its normal matrix.
+    // Recomputed when the change stamp moved, which invalidateBounds() does after
+    // any change to geometry or affineMatrix.
+    Matrix4 affine_, normalAffine_;
+    unsigned long cacheStamp_;
+
+    void updateAffineCache() {
+        if (cacheStamp_ == getChangeStamp())
+            return;
+        const Matrix4* decode = geometry->getPositionDecode();
+        affine_ = decode ? affineMatrix * *decode : affineMatrix;
+        normalAffine_ = normalMatrix(affine_);
+        cacheStamp_ = getChangeStamp();
     }
 };
 
@@ -2,8 +2,10 @@
 #define SGUTILS_H
 
 #include <vector>
+#include <memory>
 
 #include "scenegraph.h"
+#include "nodepool.h"
 
 struct RbtNodesScanner : public SgNodeVisitor {
     typedef std::vector<SgRbtNode*> SgRbtNodes;
@@ -28,5 +30,64 @@ struct RbtNodesScanner : public SgNodeVisitor {
     return rbt_nodes;
 }
 
+// The animation channels of a tree: its SgRbtNodes, in dumpSgRbtNodes() order,
+// channel i being the i-th node. The tree is only scanned again once its
+// hierarchy may have changed, i.e., after SgTransformNode::getStructureVersion()
+// moved, so looking the channels up every frame costs nothing.
+//
+// Each channel also records the pool handle of its node (see nodepool.h); nodes
+// outside the SgRbtNode pool get a null handle. Pools reuse the addresses of
+// destroyed nodes, so only the handles tell an old channel's node apart from a
+// new node at the same address.
+class RbtChannelBinding {
+public:
+    explicit RbtChannelBinding(std::shared_ptr<SgNode> root)
+            : root_(std::move(root)), nodes_(dumpSgRbtNodes(root_)), handles_(getHandles(nodes_)),
+              structureVersion_(SgTransformNode::getStructureVersion()) {}
+
+    // Rescan the tree if some hierarchy changed since the last scan. Returns true
+    // if the channels are no longer those of the last call; the handles of the
+    // previous ones are then given in `previous'.
+    bool refresh(std::vector<PoolHandle<SgRbtNode>>& previous) {
+        if (structureVersion_ == SgTransformNode::getStructureVersion())
+            return false;
+        structureVersion_ = SgTransformNode::getStructureVersion();
+        std::vector<SgRbtNode*> nodes = dumpSgRbtNodes(root_);
+        std::vector<PoolHandle<SgRbtNode>> handles = getHandles(nodes);
+        if (nodes == nodes_ && handles == handles_)
+            return false;
+        previous.swap(handles_);
+        nodes_.swap(nodes);
+        handles_.swap(handles);
+        return true;
+    }
+
+    int getNumChannels() const {
+        return nodes_.size();
+    }
+
+    const std::vector<SgRbtNode*>& getNodes() const {
+        return nodes_;
+    }
+
+    const std::vector<PoolHandle<SgRbtNode>>& getHandles() const {
+        return handles_;
+    }
+
+private:
+    std::shared_ptr<SgNode> root_;
+    std::vector<SgRbtNode*> nodes_;
+    std::vector<PoolHandle<SgRbtNode>> handles_;
+    unsigned long structureVersion_;
+
+    static std::vector<PoolHandle<SgRbtNode>> getHandles(const std::vector<SgRbtNode*>& nodes) {
+        std::vector<PoolHandle<SgRbtNode>> handles;
+        handles.reserve(nodes.size());
+        for (SgRbtNode* node : nodes)
+            handles.push_back(getNodePool<SgRbtNode>().getHandle(node));
+        return handles;
+    }
+};
+
 
 #endif
\ No newline at end of file
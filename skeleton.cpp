@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "skeleton.h"
+
+using namespace std;
+
+Skeleton::Skeleton(const JointDesc* joints, int numJoints)
+        : names_(numJoints), parents_(numJoints), bindPoses_(numJoints) {
+    for (int i = 0; i < numJoints; ++i) {
+        const JointDesc& j = joints[i];
+        if (j.parent < -1 || j.parent >= i)
+            throw runtime_error(string("Parent of joint ") + j.name + " does not precede it");
+        names_[i] = j.name;
+        parents_[i] = j.parent;
+        bindPoses_[i] = RigTForm(Cvec3(j.x, j.y, j.z), Quat(j.qw, j.qx, j.qy, j.qz));
+    }
+}
+
+shared_ptr<Skeleton> Skeleton::load(const string& filename) {
+    ifstream f(filename.c_str());
+    if (!f)
+        throw runtime_error("Cannot open file " + filename);
+
+    int numJoints;
+    if (!(f >> numJoints) || numJoints <= 0)
+        throw runtime_error("Invalid number of joints in " + filename);
+    vector<string> names(numJoints);
+    vector<JointDesc> joints(numJoints);
+    for (int i = 0; i < numJoints; ++i) {
+        JointDesc& j = joints[i];
+        // the end of the file may come right after the last number
+        if (!(f >> names[i] >> j.parent >> j.x >> j.y >> j.z >> j.qw >> j.qx >> j.qy >> j.qz))
+            throw runtime_error("Cannot read joint " + to_string(i) + " of " + filename);
+        j.name = names[i].c_str();
+    }
+    return make_shared<Skeleton>(joints.data(), numJoints);
+}
+
+int Skeleton::findJoint(const string& name) const {
+    for (int i = 0, n = names_.size(); i < n; ++i) {
+        if (names_[i] == name)
+            return i;
+    }
+    return -1;
+}
+
+void Skeleton::computeWorldRbts(const RigTForm* locals, RigTForm* worlds, int numPoses) const {
+    const int n = parents_.size();
+    const int* parents = parents_.data();
+    for (int p = 0; p < numPoses; ++p, locals += n, worlds += n) {
+        for (int i = 0; i < n; ++i) {
+            const int parent = parents[i];
+            worlds[i] = parent < 0 ? locals[i] : worlds[parent] * locals[i];
+        }
+    }
+}
+
+
+SgSkeletonNode::SgSkeletonNode(shared_ptr<const Skeleton> skeleton, shared_ptr<Material> _material)
+        : material(std::move(_material)), skeleton_(std::move(skeleton)),
+          locals_(skeleton_->getBindPoses()), worlds_(locals_.size()), worldsDirty_(true) {}
+
+int SgSkeletonNode::addPart(int joint, shared_ptr<Geometry> geometry,
+                            const Cvec3& translation, const Cvec3& eulerAngles, const Cvec3& scales) {
+    Part part;
+    part.joint = joint;
+    part.affine = Matrix4::makeTranslation(translation) *
+                  Matrix4::makeXRotation(eulerAngles[0]) *
+                  Matrix4::makeYRotation(eulerAngles[1]) *
+                  Matrix4::makeZRotation(eulerAngles[2]) *
+                  Matrix4::makeScale(scales);
+    if (const Matrix4* decode = geometry->getPositionDecode())
+        part.affine = part.affine * *decode;
+    part.normalAffine = normalMatrix(part.affine);
+    part.geometry = std::move(geometry);
+    parts_.push_back(part);
+    invalidateBounds();
+    return parts_.size() - 1;
+}
+
+void SgSkeletonNode::setJointRbt(int joint, const RigTForm& rbt) {
+    locals_[joint] = rbt;
+    invalidatePose();
+}
+
+void SgSkeletonNode::setPose(const RigTForm* locals) {
+    copy(locals, locals + locals_.size(), locals_.begin());
+    invalidatePose();
+}
+
+void SgSkeletonNode::invalidatePose() {
+    worldsDirty_ = true;
+    invalidateBounds();
+}
+
+const vector<RigTForm>& SgSkeletonNode::getWorldJointRbts() {
+    if (worldsDirty_) {
+        skeleton_->computeWorldRbts(locals_.data(), worlds_.data());
+        worldsDirty_ = false;
+    }
+    return worlds_;
+}
+
+Bounds SgSkeletonNode::getBounds() {
+    const vector<RigTForm>& worlds = getWorldJointRbts();
+    Bounds bounds;
+    for (size_t i = 0; i < parts_.size(); ++i) {
+        const Part& part = parts_[i];
+        const Bounds* partBounds = part.geometry->getBounds();
+        if (!partBounds)
+            return Bounds::infinite();
+        bounds.extend(partBounds->transformed(rigTFormToMatrix(worlds[part.joint]) * part.affine));
+    }
+    return bounds;
+}
+
+Material& SgSkeletonNode::getDrawMaterial() const {
+    if (g_overridingMaterial)
+        return *(overridingMaterial ? overridingMaterial : g_overridingMaterial);
+    return *material;
+}
+
+void SgSkeletonNode::getPartMatrices(int part, const Matrix4& MVM, const Matrix4& NMVM,
+                                     Matrix4& partMVM, Matrix4& partNMVM) const {
+    const Part& p = parts_[part];
+    const RigTForm& joint = worlds_[p.joint];
+    partMVM = MVM * rigTFormToMatrix(joint) * p.affine;
+    partNMVM = NMVM * normalMatrix(joint, p.normalAffine);
+}
+
+void SgSkeletonNode::draw(Uniforms& uniforms, const Matrix4& MVM, const Matrix4& NMVM) {
+    getWorldJointRbts();
+    Material& drawMaterial = getDrawMaterial();
+    Matrix4 partMVM, partNMVM;
+    for (int i = 0, n = parts_.size(); i < n; ++i) {
+        getPartMatrices(i, MVM, NMVM, partMVM, partNMVM);
+        sendModelViewNormalMatrix(uniforms, partMVM, partNMVM);
+        drawMaterial.draw(*parts_[i].geometry, uniforms);
+    }
+}
+
+bool SgSkeletonNode::enqueue(RenderQueue& queue, const Matrix4& MVM, const Matrix4& NMVM) {
+    getWorldJointRbts();
+    Material& drawMaterial = getDrawMaterial();
+    Matrix4 partMVM, partNMVM;
+    for (int i = 0, n = parts_.size(); i < n; ++i) {
+        getPartMatrices(i, MVM, NMVM, partMVM, partNMVM);
+        queue.push(partMVM, partNMVM, drawMaterial, *parts_[i].geometry);
+    }
+    return true;
+}
+
+void SgSkeletonNode::requeue(RenderQueue& queue, int draw, const Matrix4& MVM, const Matrix4& NMVM) {
+    getWorldJointRbts();
+    Matrix4 partMVM, partNMVM;
+    for (int i = 0, n = parts_.size(); i < n; ++i) {
+        getPartMatrices(i, MVM, NMVM, partMVM, partNMVM);
+        queue.setMatrix(draw + i, partMVM, partNMVM);
+    }
+}
@@ -0,0 +1,171 @@
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <vector>
+#include <memory>
+#include <string>
+
+#include "matrix4.h"
+#include "rigtform.h"
+#include "bounds.h"
+#include "geometry.h"
+#include "material.h"
+#include "renderqueue.h"
+#include "scenegraph.h"
+
+// Description of one joint, plain enough to be written as a constexpr table:
+//
+//   constexpr JointDesc ARM[] = {
+//       {"shoulder", -1},
+//       {"elbow", 0, 0.75, 0, 0},
+//   };
+struct JointDesc {
+    const char* name;
+    int parent;                          // index of the parent joint, -1 for a root
+    double x = 0, y = 0, z = 0;          // translation of the bind pose
+    double qw = 1, qx = 0, qy = 0, qz = 0; // rotation of the bind pose
+};
+
+// A rig: a table of joints, each with the index of its parent joint and its bind
+// pose, the rbt of the joint relative to its parent (or, for roots, to the
+// skeleton's frame). Parents always come before their children, so forward
+// kinematics is a single pass over the table.
+//
+// A skeleton is immutable and meant to be shared by all characters with the same
+// rig, each of which only keeps an array of local joint rbts.
+class Skeleton {
+public:
+    // Throws runtime_error if a parent index does not precede its joint
+    Skeleton(const JointDesc* joints, int numJoints);
+
+    template<int n>
+    explicit Skeleton(const JointDesc (&joints)[n]) : Skeleton(joints, n) {}
+
+    // Reads a text file: the number of joints, then for each joint its name, its
+    // parent index and the bind pose as translation and quaternion (w, x, y, z),
+    // i.e., the fields of a JointDesc. Throws runtime_error if the file cannot be
+    // read or the joints are not in order.
+    static std::shared_ptr<Skeleton> load(const std::string& filename);
+
+    int getNumJoints() const {
+        return parents_.size();
+    }
+
+    int getParent(int joint) const {
+        return parents_[joint];
+    }
+
+    const std::string& getName(int joint) const {
+        return names_[joint];
+    }
+
+    // Index of the joint with the given name, -1 if there is none
+    int findJoint(const std::string& name) const;
+
+    const RigTForm& getBindPose(int joint) const {
+        return bindPoses_[joint];
+    }
+
+    // The bind poses as one array, to initialize local rbts from
+    const std::vector<RigTForm>& getBindPoses() const {
+        return bindPoses_;
+    }
+
+    // Forward kinematics for `numPoses' poses of this skeleton: locals and
+    // worlds hold getNumJoints() rbts per pose, one pose after the other.
+    // worlds[j] becomes the rbt of joint j relative to the skeleton's frame,
+    // i.e., the product of the local rbts from its root down to it.
+    void computeWorldRbts(const RigTForm* locals, RigTForm* worlds, int numPoses = 1) const;
+
+private:
+    std::vector<std::string> names_;
+    std::vector<int> parents_;
+    std::vector<RigTForm> bindPoses_;
+};
+
+// A posed skeleton as a single shape node: it keeps the local rbts of the joints
+// and draws geometries rigidly attached to them, all with one material. Where
+// a hierarchy of SgRbtNodes costs a node and a virtual visit per joint, posing
+// this node writes into an array, and the joint rbts are computed by
+// Skeleton::computeWorldRbts() when it is next drawn or bounded.
+//
+// The joint rbts are relative to the node's frame, which is that of its parent
+// transform node: getAffineMatrix() is the identity.
+class SgSkeletonNode : public SgShapeNode {
+public:
+    // As for SgGeometryShapeNode: if they are assigned, call markChanged()
+    std::shared_ptr<Material> material;
+    std::shared_ptr<Material> overridingMaterial;
+
+    // Starts in the bind pose. `material' is used as by SgGeometryShapeNode.
+    SgSkeletonNode(std::shared_ptr<const Skeleton> skeleton, std::shared_ptr<Material> material);
+
+    const Skeleton& getSkeleton() const {
+        return *skeleton_;
+    }
+
+    // Attach `geometry' to `joint', placed in the joint's frame as by
+    // SgGeometryShapeNode's affine matrix. Returns the index of the part.
+    int addPart(int joint, std::shared_ptr<Geometry> geometry,
+                const Cvec3& translation = Cvec3(0, 0, 0),
+                const Cvec3& eulerAngles = Cvec3(0, 0, 0),
+                const Cvec3& scales = Cvec3(1, 1, 1));
+
+    int getNumParts() const {
+        return parts_.size();
+    }
+
+    // Rbt of a joint relative to its parent joint
+    const RigTForm& getJointRbt(int joint) const {
+        return locals_[joint];
+    }
+
+    void setJointRbt(int joint, const RigTForm& rbt);
+
+    // Set the rbts of all joints at once, from getSkeleton().getNumJoints() rbts
+    void setPose(const RigTForm* locals);
+
+    // Rbts of the joints relative to the node's frame, for the current pose
+    const std::vector<RigTForm>& getWorldJointRbts();
+
+    virtual Matrix4 getAffineMatrix() {
+        return Matrix4();
+    }
+
+    virtual Matrix4 getNormalAffineMatrix() {
+        return Matrix4();
+    }
+
+    // Union of the bounds of all parts in the current pose
+    virtual Bounds getBounds();
+
+    virtual void draw(Uniforms& uniforms, const Matrix4& MVM, const Matrix4& NMVM);
+
+    // Pushes one draw per part, in the order of addPart()
+    virtual bool enqueue(RenderQueue& queue, const Matrix4& MVM, const Matrix4& NMVM);
+
+    virtual void requeue(RenderQueue& queue, int draw, const Matrix4& MVM, const Matrix4& NMVM);
+
+private:
+    struct Part {
+        int joint;
+        std::shared_ptr<Geometry> geometry;
+        Matrix4 affine, normalAffine;   // including the geometry's position decode
+    };
+
+    std::shared_ptr<const Skeleton> skeleton_;
+    std::vector<Part> parts_;
+    std::vector<RigTForm> locals_, worlds_;
+    bool worldsDirty_;
+
+    Material& getDrawMaterial() const;
+
+    // Matrices of a part, given those of the node. The world rbts must be up to date.
+    void getPartMatrices(int part, const Matrix4& MVM, const Matrix4& NMVM,
+                         Matrix4& partMVM, Matrix4& partNMVM) const;
+
+    // The pose changed: the joints' world rbts, and the bounds, are stale
+    void invalidatePose();
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "skinning.h"
+
+using namespace std;
+
+//----------------------------------
+// SkinnedGeometry
+//----------------------------------
+
+const int SkinnedGeometry::BATCH;
+const int SkinnedGeometry::TASK_VERTICES;
+
+SkinnedGeometry::SkinnedGeometry(const SkinVertex* vertices, const unsigned* indices,
+                                 int numVertices, int numIndices, int numJoints)
+        : numVertices_(numVertices), numJoints_(numJoints),
+          jointMatrices_(12 * numJoints), jointDualQuats_(8 * numJoints), posed_(numVertices),
+          vbo_(new FormattedVbo(VertexPN::FORMAT)), ibo_(new FormattedIbo(GL_UNSIGNED_INT)) {
+    const int padded = (numVertices + BATCH - 1) / BATCH * BATCH;
+    px_.assign(padded, 0.f);
+    py_.assign(padded, 0.f);
+    pz_.assign(padded, 0.f);
+    nx_.assign(padded, 0.f);
+    ny_.assign(padded, 0.f);
+    nz_.assign(padded, 0.f);
+    for (int k = 0; k < SkinVertex::MAX_INFLUENCES; ++k) {
+        joints_[k].assign(padded, 0);
+        weights_[k].assign(padded, 0.f);
+    }
+
+    if (numJoints <= 0)
+        throw runtime_error("SkinnedGeometry: no joints");
+    for (int i = 0; i < numVertices; ++i) {
+        const SkinVertex& v = vertices[i];
+        px_[i] = v.p[0];
+        py_[i] = v.p[1];
+        pz_[i] = v.p[2];
+        nx_[i] = v.n[0];
+        ny_[i] = v.n[1];
+        nz_[i] = v.n[2];
+        float sum = 0;
+        for (int k = 0; k < SkinVertex::MAX_INFLUENCES; ++k) {
+            if (v.weights[k] == 0)
+                continue;
+            if (v.joints[k] < 0 || v.joints[k] >= numJoints)
+                throw runtime_error("SkinnedGeometry: vertex influenced by a joint out of range");
+            joints_[k][i] = v.joints[k];
+            weights_[k][i] = v.weights[k];
+            sum += v.weights[k];
+        }
+        for (int k = 0; sum > 0 && k < SkinVertex::MAX_INFLUENCES; ++k)
+            weights_[k][i] /= sum;
+    }
+
+    wire(vbo_);
+    indexedBy(ibo_);
+    primitiveType(GL_TRIANGLES);
+    ibo_->upload(indices, numIndices);
+
+    const vector<RigTForm> bind(numJoints);
+    skin(&bind[0]);
+}
+
+void SkinnedGeometry::skin(const RigTForm* skinningRbts, Method method, WorkerPool* pool) {
+    // per joint data, in float for the batch loops
+    for (int j = 0; j < numJoints_; ++j) {
+        const RigTForm& rbt = skinningRbts[j];
+        if (method == LINEAR_BLEND) {
+            const Matrix4 m = rigTFormToMatrix(rbt);
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 4; ++c)
+                    jointMatrices_[12 * j + 4 * r + c] = float(m(r, c));
+            }
+        }
+        else {
+            const Quat real = rbt.getRotation();
+            const Quat dual = Quat(0, rbt.getTranslation()) * real * 0.5;
+            for (int c = 0; c < 4; ++c) {
+                jointDualQuats_[8 * j + c] = float(real[c]);
+                jointDualQuats_[8 * j + 4 + c] = float(dual[c]);
+            }
+        }
+    }
+
+    const int padded = px_.size();
+    const int numTasks = max(1, (padded + TASK_VERTICES - 1) / TASK_VERTICES);
+    taskMin_.assign(numTasks, Cvec3f(HUGE_VALF));
+    taskMax_.assign(numTasks, Cvec3f(-HUGE_VALF));
+    auto task = [this, method, padded](int task) {
+        const int begin = task * TASK_VERTICES, end = min(padded, begin + TASK_VERTICES);
+        if (method == LINEAR_BLEND)
+            skinLinear(begin, end, taskMin_[task], taskMax_[task]);
+        else
+            skinDualQuat(begin, end, taskMin_[task], taskMax_[task]);
+    };
+    if (pool && numTasks > 1)
+        pool->run(numTasks, task);
+    else {
+        for (int i = 0; i < numTasks; ++i)
+            task(i);
+    }
+
+    if (numVertices_ == 0)
+        return;
+    Cvec3 corners[2] = {Cvec3(HUGE_VAL), Cvec3(-HUGE_VAL)};
+    for (int t = 0; t < numTasks; ++t) {
+        for (int c = 0; c < 3; ++c) {
+            corners[0][c] = min(corners[0][c], double(taskMin_[t][c]));
+            corners[1][c] = max(corners[1][c], double(taskMax_[t][c]));
+        }
+    }
+    vbo_->upload(&posed_[0], numVertices_, true);
+    bounds(Bounds::fromPoints(corners, 2));
+}
+
+// Write out a batch of posed vertices, skipping the padding
+static inline void storeBatch(VertexPN* out, int begin, int count,
+                              const float* x, const float* y, const float* z,
+                              const float* nx, const float* ny, const float* nz,
+                              Cvec3f& boxMin, Cvec3f& boxMax) {
+    for (int i = 0; i < count; ++i) {
+        VertexPN& v = out[begin + i];
+        v.p = Cvec3f(x[i], y[i], z[i]);
+        v.n = Cvec3f(nx[i], ny[i], nz[i]);
+        boxMin[0] = min(boxMin[0], x[i]);
+        boxMin[1] = min(boxMin[1], y[i]);
+        boxMin[2] = min(boxMin[2], z[i]);
+        boxMax[0] = max(boxMax[0], x[i]);
+        boxMax[1] = max(boxMax[1], y[i]);
+        boxMax[2] = max(boxMax[2], z[i]);
+    }
+}
+
+void SkinnedGeometry::skinLinear(int begin, int end, Cvec3f& boxMin, Cvec3f& boxMax) {
+    const float* mats = &jointMatrices_[0];
+    for (int b = begin; b < end; b += BATCH) {
+        // blended 3x4 matrix per vertex
+        float m[12][BATCH];
+        for (int c = 0; c < 12; ++c) {
+            for (int i = 0; i < BATCH; ++i)
+                m[c][i] = 0;
+        }
+        for (int k = 0; k < SkinVertex::MAX_INFLUENCES; ++k) {
+            const int* joints = &joints_[k][b];
+            const float* weights = &weights_[k][b];
+            for (int i = 0; i < BATCH; ++i) {
+                const float* jm = mats + 12 * joints[i];
+                const float w = weights[i];
+                for (int c = 0; c < 12; ++c)
+                    m[c][i] += w * jm[c];
+            }
+        }
+
+        float x[BATCH], y[BATCH], z[BATCH], nx[BATCH], ny[BATCH], nz[BATCH];
+        const float* px = &px_[b], * py = &py_[b], * pz = &pz_[b];
+        const float* qx = &nx_[b], * qy = &ny_[b], * qz = &nz_[b];
+        for (int i = 0; i < BATCH; ++i) {
+            x[i] = m[0][i] * px[i] + m[1][i] * py[i] + m[2][i] * pz[i] + m[3][i];
+            y[i] = m[4][i] * px[i] + m[5][i] * py[i] + m[6][i] * pz[i] + m[7][i];
+            z[i] = m[8][i] * px[i] + m[9][i] * py[i] + m[10][i] * pz[i] + m[11][i];
+            // the blend of rotations is not a rotation, so renormalize; the
+            // normal matrix of a blend would only differ by its scale
+            const float ax = m[0][i] * qx[i] + m[1][i] * qy[i] + m[2][i] * qz[i];
+            const float ay = m[4][i] * qx[i] + m[5][i] * qy[i] + m[6][i] * qz[i];
+            const float az = m[8][i] * qx[i] + m[9][i] * qy[i] + m[10][i] * qz[i];
+            const float s = 1 / sqrtf(ax * ax + ay * ay + az * az + 1e-20f);
+            nx[i] = ax * s;
+            ny[i] = ay * s;
+            nz[i] = az * s;
+        }
+        storeBatch(&posed_[0], b, min(BATCH, numVertices_ - b), x, y, z, nx, ny, nz, boxMin, boxMax);
+    }
+}
+
+void SkinnedGeometry::skinDualQuat(int begin, int end, Cvec3f& boxMin, Cvec3f& boxMax) {
+    const float* dqs = &jointDualQuats_[0];
+    for (int b = begin; b < end; b += BATCH) {
+        // blended dual quaternion per vertex, each joint's flipped to the
+        // hemisphere of the first influence's so the blend takes the short way
+        float q[8][BATCH];
+        for (int c = 0; c < 8; ++c) {
+            for (int i = 0; i < BATCH; ++i)
+                q[c][i] = 0;
+        }
+        const int* firstJoints = &joints_[0][b];
+        for (int k = 0; k < SkinVertex::MAX_INFLUENCES; ++k) {
+            const int* joints = &joints_[k][b];
+            const float* weights = &weights_[k][b];
+            for (int i = 0; i < BATCH; ++i) {
+                const float* d = dqs + 8 * joints[i];
+                const float* d0 = dqs + 8 * firstJoints[i];
+                const float dot = d[0] * d0[0] + d[1] * d0[1] + d[2] * d0[2] + d[3] * d0[3];
+                const float w = copysignf(weights[i], dot);
+                for (int c = 0; c < 8; ++c)
+                    q[c][i] += w * d[c];
+            }
+        }
+
+        float x[BATCH], y[BATCH], z[BATCH], nx[BATCH], ny[BATCH], nz[BATCH];
+        const float* px = &px_[b], * py = &py_[b], * pz = &pz_[b];
+        const float* qx = &nx_[b], * qy = &ny_[b], * qz = &nz_[b];
+        for (int i = 0; i < BATCH; ++i) {
+            const float s = 1 / sqrtf(q[0][i] * q[0][i] + q[1][i] * q[1][i] + q[2][i] * q[2][i] + q[3][i] * q[3][i] +
+                                      1e-20f);
+            const float rw = q[0][i] * s, rx = q[1][i] * s, ry = q[2][i] * s, rz = q[3][i] * s;
+            const float dw = q[4][i] * s, dx = q[5][i] * s, dy = q[6][i] * s, dz = q[7][i] * s;
+
+            // translation 2 dual conj(real)
+            const float tx = 2 * (rw * dx - dw * rx + ry * dz - rz * dy);
+            const float ty = 2 * (rw * dy - dw * ry + rz * dx - rx * dz);
+            const float tz = 2 * (rw * dz - dw * rz + rx * dy - ry * dx);
+
+            // v + 2 r x (r x v + w v), for the position and the normal
+            float cx = ry * pz[i] - rz * py[i] + rw * px[i];
+            float cy = rz * px[i] - rx * pz[i] + rw * py[i];
+            float cz = rx * py[i] - ry * px[i] + rw * pz[i];
+            x[i] = px[i] + 2 * (ry * cz - rz * cy) + tx;
+            y[i] = py[i] + 2 * (rz * cx - rx * cz) + ty;
+            z[i] = pz[i] + 2 * (rx * cy - ry * cx) + tz;
+
+            cx = ry * qz[i] - rz * qy[i] + rw * qx[i];
+            cy = rz * qx[i] - rx * qz[i] + rw * qy[i];
+            cz = rx * qy[i] - ry * qx[i] + rw * qz[i];
+            nx[i] = qx[i] + 2 * (ry * cz - rz * cy);
+            ny[i] = qy[i] + 2 * (rz * cx - rx * cz);
+            nz[i] = qz[i] + 2 * (rx * cy - ry * cx);
+        }
+        storeBatch(&posed_[0], b, min(BATCH, numVertices_ - b), x, y, z, nx, ny, nz, boxMin, boxMax);
+    }
+}
+
+//----------------------------------
+// SkinRig
+//----------------------------------
+
+SkinRig::SkinRig(SgTransformNode* root, shared_ptr<const Skeleton> skeleton, const vector<SgRbtNode*>& joints)
+        : root_(root), skeleton_(std::move(skeleton)), joints_(joints), locals_(joints.size()),
+          worlds_(joints.size()), invBindRbts_(joints.size()), skinningRbts_(joints.size()),
+          version_(SgNode::getChangeVersion()) {
+    if (int(joints_.size()) != skeleton_->getNumJoints())
+        throw runtime_error("SkinRig: not one node per joint of the skeleton");
+    for (int j = 0, n = joints_.size(); j < n; ++j) {
+        const int parent = skeleton_->getParent(j);
+        const bool laidOut = parent < 0 ? joints_[j] == root_ || joints_[j]->getParent() == root_
+                                        : joints_[j]->getParent() == joints_[parent];
+        if (!laidOut)
+            throw runtime_error("SkinRig: the node of joint " + skeleton_->getName(j) +
+                                " is not a child of that of its parent");
+    }
+
+    pose();
+    for (size_t j = 0; j < joints_.size(); ++j)
+        invBindRbts_[j] = inv(worlds_[j]);
+}
+
+void SkinRig::pose() {
+    for (size_t j = 0; j < joints_.size(); ++j)
+        locals_[j] = joints_[j] == root_ ? RigTForm() : joints_[j]->getRbt();
+    skeleton_->computeWorldRbts(&locals_[0], &worlds_[0]);
+}
+
+bool SkinRig::update() {
+    bool moved = false;
+    for (size_t j = 0; j < joints_.size() && !moved; ++j)
+        moved = joints_[j] != root_ && joints_[j]->getChangeStamp() > version_;
+    version_ = SgNode::getChangeVersion();
+    if (!moved)
+        return false;
+    pose();
+    for (size_t j = 0; j < joints_.size(); ++j)
+        skinningRbts_[j] = worlds_[j] * invBindRbts_[j];
+    return true;
+}
@@ -0,0 +1,133 @@
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "rigtform.h"
+#include "geometry.h"
+#include "scenegraph.h"
+#include "skeleton.h"
+#include "workerpool.h"
+
+// Vertex of a skinned mesh in its bind pose: position and normal in the mesh's
+// frame, and up to MAX_INFLUENCES joints that move it, with their weights. Unused
+// influences have weight 0.
+struct SkinVertex {
+    static const int MAX_INFLUENCES = 4;
+
+    Cvec3f p, n;
+    int joints[MAX_INFLUENCES];
+    float weights[MAX_INFLUENCES];
+};
+
+// A mesh whose vertices follow a set of joints, skinned on the CPU and drawn as
+// a plain VertexPN geometry, so a whole character takes a single draw.
+//
+// skin() blends the joints' skinning rbts per vertex, either linearly
+// (LINEAR_BLEND, the classic matrix palette) or as dual quaternions
+// (DUAL_QUATERNION), which keeps the volume around bent joints from collapsing.
+// The bind pose is kept as padded float arrays, one per coordinate as in
+// PositionArrays, and the vertices are processed BATCH at a time. The loops that
+// transform and renormalize a batch are branch free, and GCC vectorizes them at
+// -O2 given -fno-math-errno (see the Makefile); the loops that gather the
+// joints' transforms stay scalar.
+// Batches are split among the threads of a WorkerPool, if given.
+class SkinnedGeometry : public BufferObjectGeometry {
+public:
+    enum Method {
+        LINEAR_BLEND,
+        DUAL_QUATERNION
+    };
+
+    static const int BATCH = 8;
+
+    // Vertices per WorkerPool task
+    static const int TASK_VERTICES = 1024;
+
+    // Weights are normalized to sum to one. Throws runtime_error if numJoints is
+    // not positive, or a vertex refers to a joint outside [0, numJoints). Starts
+    // in the bind pose.
+    SkinnedGeometry(const SkinVertex* vertices, const unsigned* indices,
+                    int numVertices, int numIndices, int numJoints);
+
+    int getNumJoints() const {
+        return numJoints_;
+    }
+
+    int getNumVertices() const {
+        return numVertices_;
+    }
+
+    // Pose the mesh and upload it. skinningRbts[j] maps the bind pose of joint j
+    // to its current pose, both in the mesh's frame (see SkinRig). Updates the
+    // bounds, so shapes drawing this geometry must call invalidateBounds()
+    // afterwards. Must be called on the GL thread.
+    void skin(const RigTForm* skinningRbts, Method method = LINEAR_BLEND, WorkerPool* pool = NULL);
+
+private:
+    int numVertices_, numJoints_;
+
+    // Bind pose and influences, padded with zero weights to a multiple of BATCH
+    std::vector<float> px_, py_, pz_, nx_, ny_, nz_;
+    std::vector<int> joints_[SkinVertex::MAX_INFLUENCES];
+    std::vector<float> weights_[SkinVertex::MAX_INFLUENCES];
+
+    // Per joint, for the current skin(): the 3x4 matrix of the skinning rbt in row
+    // major order, or its dual quaternion (real w, x, y, z, then dual w, x, y, z)
+    std::vector<float> jointMatrices_, jointDualQuats_;
+
+    std::vector<VertexPN> posed_;
+    std::vector<Cvec3f> taskMin_, taskMax_;
+
+    std::shared_ptr<FormattedVbo> vbo_;
+    std::shared_ptr<FormattedIbo> ibo_;
+
+    // Skin vertices [begin, end), a multiple of BATCH, into posed_, and grow the
+    // box [boxMin, boxMax] to enclose them
+    void skinLinear(int begin, int end, Cvec3f& boxMin, Cvec3f& boxMax);
+
+    void skinDualQuat(int begin, int end, Cvec3f& boxMin, Cvec3f& boxMax);
+};
+
+// The joints of a SgRbtNode hierarchy that drive a SkinnedGeometry, laid out as
+// a Skeleton: the node of joint j is the child of the node of its parent joint,
+// or, for a root joint, of `root', the transform node the skinned shape hangs
+// from. The local rbts of the nodes are gathered into an array and posed with
+// Skeleton::computeWorldRbts(), in one pass over the joints.
+//
+// The bind pose is the pose of the joints when the rig is made; the skinning
+// rbts then map it to their current pose, in the frame of root.
+class SkinRig {
+public:
+    // One node per joint of the skeleton. A root joint's node may be root
+    // itself, which then never moves. Throws runtime_error if the nodes are not
+    // laid out as the skeleton. The nodes must outlive the rig.
+    SkinRig(SgTransformNode* root, std::shared_ptr<const Skeleton> skeleton, const std::vector<SgRbtNode*>& joints);
+
+    int getNumJoints() const {
+        return joints_.size();
+    }
+
+    // Recompute the skinning rbts if a joint moved since the last call. Returns
+    // whether they changed.
+    bool update();
+
+    const std::vector<RigTForm>& getSkinningRbts() const {
+        return skinningRbts_;
+    }
+
+private:
+    SgTransformNode* root_;
+    std::shared_ptr<const Skeleton> skeleton_;
+    std::vector<SgRbtNode*> joints_;
+    std::vector<RigTForm> locals_, worlds_;     // of the joints, relative to their parent joint and to root
+    std::vector<RigTForm> invBindRbts_, skinningRbts_;
+
+    // Gather the local rbts of the joints and pose them into worlds_
+    void pose();
+    unsigned long version_;     // SgNode change version of the last update()
+};
+
+#endif
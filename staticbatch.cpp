@@ -0,0 +1,180 @@
+#include <algorithm>
+
+#include "packedgeometry.h"
+#include "staticbatch.h"
+
+using namespace std;
+
+// Attributes that are directions, and are transformed like normals
+static bool isDirectionAttrib(const string& name) {
+    return name == "aNormal" || name == "aTangent" || name == "aBinormal";
+}
+
+// Number of floats the batch stores for an attribute, 0 if it cannot be decoded
+static int getNumFloats(const VertexFormat::AttribDesc& ad) {
+    switch (ad.type) {
+        case GL_FLOAT:
+        case GL_HALF_FLOAT:
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+            break;
+        case GL_INT_2_10_10_10_REV:
+            if (!ad.normalized || ad.size != 4)
+                return 0;
+            break;
+        default:
+            return 0;
+    }
+    if (ad.name == "aPosition" || isDirectionAttrib(ad.name))
+        return ad.size >= 3 ? 3 : 0;
+    return ad.size;
+}
+
+// Decode `numFloats' components of an attribute as GL would feed them to a shader
+static void decodeAttrib(const char* p, const VertexFormat::AttribDesc& ad, int numFloats, float* out) {
+    if (ad.type == GL_INT_2_10_10_10_REV) {
+        const Cvec4f v = unpackSnorm1010102(*reinterpret_cast<const GLuint*>(p));
+        for (int i = 0; i < numFloats; ++i)
+            out[i] = v[i];
+        return;
+    }
+    for (int i = 0; i < numFloats; ++i) {
+        switch (ad.type) {
+            case GL_FLOAT:
+                out[i] = reinterpret_cast<const GLfloat*>(p)[i];
+                break;
+            case GL_HALF_FLOAT:
+                out[i] = unpackHalf(reinterpret_cast<const GLushort*>(p)[i]);
+                break;
+            case GL_BYTE:
+                out[i] = reinterpret_cast<const GLbyte*>(p)[i];
+                if (ad.normalized)
+                    out[i] = max(out[i] / 127.f, -1.f);
+                break;
+            case GL_UNSIGNED_BYTE:
+                out[i] = reinterpret_cast<const GLubyte*>(p)[i];
+                if (ad.normalized)
+                    out[i] /= 255.f;
+                break;
+            case GL_SHORT:
+                out[i] = ad.normalized ? unpackSnorm16(reinterpret_cast<const GLshort*>(p)[i])
+                                       : reinterpret_cast<const GLshort*>(p)[i];
+                break;
+            case GL_UNSIGNED_SHORT:
+                out[i] = reinterpret_cast<const GLushort*>(p)[i];
+                if (ad.normalized)
+                    out[i] /= 65535.f;
+                break;
+        }
+    }
+}
+
+// The all float counterpart of `source'
+static VertexFormat makeFloatFormat(const VertexFormat& source) {
+    int size = 0;
+    for (int i = 0; i < source.getNumAttribs(); ++i)
+        size += getNumFloats(source.getAttrib(i)) * sizeof(GLfloat);
+
+    VertexFormat format(size);
+    int offset = 0;
+    for (int i = 0; i < source.getNumAttribs(); ++i) {
+        const VertexFormat::AttribDesc& ad = source.getAttrib(i);
+        format.put(ad.name, getNumFloats(ad), GL_FLOAT, GL_FALSE, offset);
+        offset += getNumFloats(ad) * sizeof(GLfloat);
+    }
+    return format;
+}
+
+bool StaticBatch::canBatch(Geometry& geometry) {
+    BufferObjectGeometry* bog = dynamic_cast<BufferObjectGeometry*>(&geometry);
+    if (!bog || bog->getPrimitiveType() != GL_TRIANGLES)
+        return false;
+    const shared_ptr<FormattedVbo> vbo = bog->getSoleVertexBuffer();
+    if (!vbo)
+        return false;
+
+    const VertexFormat& format = vbo->getVertexFormat();
+    if (format.getAttribIndexForName("aPosition") < 0)
+        return false;
+    for (int i = 0; i < format.getNumAttribs(); ++i) {
+        if (getNumFloats(format.getAttrib(i)) == 0)
+            return false;
+    }
+    return true;
+}
+
+const VertexFormat& StaticBatch::getVertexFormat(Geometry& geometry) {
+    return dynamic_cast<BufferObjectGeometry&>(geometry).getSoleVertexBuffer()->getVertexFormat();
+}
+
+StaticBatch::StaticBatch(Material& material, const VertexFormat& format)
+        : material_(material), sourceFormat_(format), format_(makeFloatFormat(format)),
+          vbo_(new FormattedVbo(format_)), ibo_(new FormattedIbo(GL_UNSIGNED_INT)),
+          geometry_(new BufferObjectGeometry()) {
+    geometry_->wire(vbo_).indexedBy(ibo_).primitiveType(GL_TRIANGLES);
+}
+
+void StaticBatch::clear() {
+    vertices_.clear();
+    indices_.clear();
+    positions_.clear();
+}
+
+void StaticBatch::add(Geometry& geometry, const Matrix4& modelMatrix) {
+    BufferObjectGeometry& bog = dynamic_cast<BufferObjectGeometry&>(geometry);
+    const shared_ptr<FormattedVbo> vbo = bog.getSoleVertexBuffer();
+    assert(&vbo->getVertexFormat() == &sourceFormat_);
+
+    vector<char> source;
+    vbo->download(source);
+    const int sourceSize = sourceFormat_.getVertexSize();
+    const int numVertices = source.size() / sourceSize;
+    const int numFloats = format_.getVertexSize() / sizeof(GLfloat);
+    const int base = vertices_.size() / numFloats;
+    vertices_.resize(vertices_.size() + numVertices * numFloats);
+
+    const Matrix4 normalModelMatrix = normalMatrix(modelMatrix);
+    for (int i = 0; i < sourceFormat_.getNumAttribs(); ++i) {
+        const VertexFormat::AttribDesc& from = sourceFormat_.getAttrib(i);
+        const VertexFormat::AttribDesc& to = format_.getAttrib(i);
+        const bool isPosition = from.name == "aPosition", isDirection = isDirectionAttrib(from.name);
+        for (int v = 0; v < numVertices; ++v) {
+            float* out = &vertices_[(base + v) * numFloats + to.offset / sizeof(GLfloat)];
+            decodeAttrib(&source[v * sourceSize + from.offset], from, to.size, out);
+            if (!isPosition && !isDirection)
+                continue;
+
+            const Cvec4 q = isPosition ? modelMatrix * Cvec4(out[0], out[1], out[2], 1)
+                                       : normalModelMatrix * Cvec4(out[0], out[1], out[2], 0);
+            for (int j = 0; j < 3; ++j)
+                out[j] = float(q[j]);
+            if (isPosition)
+                positions_.push_back(Cvec3(q));
+        }
+    }
+
+    vector<unsigned int> indices;
+    if (bog.isIndexed())
+        bog.getIndexBuffer()->download(indices);
+    else {
+        indices.resize(numVertices);
+        for (int v = 0; v < numVertices; ++v)
+            indices[v] = v;
+    }
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices_.push_back(base + indices[i]);
+}
+
+void StaticBatch::upload() {
+    const int numFloats = format_.getVertexSize() / sizeof(GLfloat);
+    vbo_->uploadBytes(vertices_.empty() ? NULL : &vertices_[0], vertices_.size() / numFloats);
+    ibo_->upload(indices_.empty() ? NULL : &indices_[0], indices_.size());
+    bounds_ = Bounds::fromPoints(positions_.empty() ? NULL : &positions_[0], positions_.size());
+
+    // the GL buffers have it all now
+    vector<float>().swap(vertices_);
+    vector<unsigned int>().swap(indices_);
+    vector<Cvec3>().swap(positions_);
+}
@@ -0,0 +1,80 @@
+#ifndef STATICBATCH_H
+#define STATICBATCH_H
+
+#include <vector>
+#include <memory>
+
+#include "matrix4.h"
+#include "bounds.h"
+#include "geometry.h"
+#include "material.h"
+
+// Triangles of several geometries that share a material and vertex format,
+// baked into world space in one vertex buffer and one index buffer, so that
+// they are drawn with a single draw call. The model view matrix of the batch
+// is then just the eye matrix.
+//
+// The batch stores every attribute as floats, under the same names, so packed
+// formats (see packedgeometry.h) are decoded; world positions would not fit
+// the quantization of any one geometry anyway.
+//
+// The vertices are read back from the source geometries' buffers, so baking is
+// slow and meant for geometry that rarely changes, such as static parts of the
+// scene (see SgTransformNode::setStatic() and FlatScene).
+class StaticBatch : Noncopyable {
+public:
+    // True if `geometry' can go into a batch: a BufferObjectGeometry of
+    // triangles, wired from a single vertex buffer whose attributes are of the
+    // types used in geometry.h and packedgeometry.h
+    static bool canBatch(Geometry& geometry);
+
+    // The vertex format of a geometry for which canBatch() is true
+    static const VertexFormat& getVertexFormat(Geometry& geometry);
+
+    // A batch for geometries of vertex format `format'. `material' must stay
+    // alive as long as the batch.
+    StaticBatch(Material& material, const VertexFormat& format);
+
+    Material& getMaterial() const {
+        return material_;
+    }
+
+    // Start over with no triangles
+    void clear();
+
+    // Add the triangles of `geometry', which must pass canBatch() and have the
+    // batch's vertex format, transformed to world space by `modelMatrix'
+    // (including the shape's affine matrix and position decode). Positions are
+    // transformed by the matrix, normals, tangents and binormals by its normal
+    // matrix.
+    void add(Geometry& geometry, const Matrix4& modelMatrix);
+
+    // Upload what was added since clear() for drawing through getGeometry(). The
+    // batch keeps no copy afterwards, so the next upload() must follow a clear().
+    void upload();
+
+    Geometry& getGeometry() {
+        return *geometry_;
+    }
+
+    // World space bounds of what was uploaded
+    const Bounds& getBounds() const {
+        return bounds_;
+    }
+
+private:
+    Material& material_;
+    const VertexFormat& sourceFormat_;
+    VertexFormat format_;   // all floats; must come before vbo_, which refers to it
+
+    std::vector<float> vertices_;
+    std::vector<unsigned int> indices_;
+    std::vector<Cvec3> positions_;
+    Bounds bounds_;
+
+    std::shared_ptr<FormattedVbo> vbo_;
+    std::shared_ptr<FormattedIbo> ibo_;
+    std::shared_ptr<BufferObjectGeometry> geometry_;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include <cmath>
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+
+#include "asstcommon.h"
+#include "subdivision.h"
+#include "stencilgeometry.h"
+
+using namespace std;
+
+const VertexFormat VertexStencil::FORMAT = VertexFormat(sizeof(VertexStencil))
+        .put("aStencilIndex", 1, GL_FLOAT, GL_FALSE, offsetof(VertexStencil, index))
+        .put("aFaceCorners", 3, GL_FLOAT, GL_FALSE, offsetof(VertexStencil, corners));
+
+// Each refined vertex owns three consecutive stencil rows of cageSize weights:
+// its position, and the two tangents whose cross product is its smooth normal.
+enum { POSITION_ROW = 0, TANGENT1_ROW = 1, TANGENT2_ROW = 2, ROWS_PER_VERTEX = 3 };
+
+SubdivStencilGeometry::SubdivStencilGeometry(Mesh cage, int levels)
+        : cageSize_(cage.getNumVertices()), levels_(levels), numRefined_(0),
+          vbo_(new FormattedVbo(VertexStencil::FORMAT)), stencils_(new BufferTexture(GL_R32F)) {
+    if (cageSize_ > MAX_CAGE_SIZE) {
+        stringstream s;
+        s << "SubdivStencilGeometry supports at most " << MAX_CAGE_SIZE << " cage vertices, got " << cageSize_;
+        throw runtime_error(s.str());
+    }
+    if (!isSupported())
+        throw runtime_error("SubdivStencilGeometry needs buffer textures, and GL_EXT_gpu_shader4 with GLSL 1.0");
+
+    // Refine the actual cage once. This fixes the refined topology, and its
+    // positions are used below to orient the tangent frames.
+    Mesh refined = cage;
+    for (int i = 0; i < levels_; ++i)
+        asd::subdivide(refined);
+    numRefined_ = refined.getNumVertices();
+
+    const int n = cageSize_;
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if (double(numRefined_) * ROWS_PER_VERTEX * n > maxTexels) {
+        stringstream s;
+        s << "SubdivStencilGeometry needs " << size_t(numRefined_) * ROWS_PER_VERTEX * n
+          << " stencil texels at level " << levels_ << ", but the buffer texture holds at most " << maxTexels;
+        throw runtime_error(s.str());
+    }
+    vector<float> weights(size_t(numRefined_) * ROWS_PER_VERTEX * n, 0.f);
+
+    // Position stencils. Refining a cage whose only nonzero vertex is a unit vector
+    // yields that vertex's weight in every refined position; each of the x, y and z
+    // channels carries a different cage vertex, so three columns come out per pass.
+    for (int b = 0; b < n; b += 3) {
+        Mesh basis = cage;
+        for (int j = 0; j < n; ++j) {
+            Cvec3 p(0);
+            if (j >= b && j < b + 3)
+                p[j - b] = 1;
+            basis.getVertex(j).setPosition(p);
+        }
+        for (int i = 0; i < levels_; ++i)
+            asd::subdivide(basis);
+
+        for (int v = 0; v < numRefined_; ++v) {
+            const Cvec3 p = basis.getVertex(v).getPosition();
+            float* row = &weights[(size_t(v) * ROWS_PER_VERTEX + POSITION_ROW) * n];
+            for (int k = 0; k < 3 && b + k < n; ++k)
+                row[b + k] = float(p[k]);
+        }
+    }
+
+    // Tangent stencils, built from the one-ring of each refined vertex:
+    //   t1 = sum_k cos(2 pi k / valence) P(ring_k),  t2 = sum_k sin(2 pi k / valence) P(ring_k)
+    // Both are linear in the ring positions and hence in the cage.
+    vector<int> ring;
+    for (int v = 0; v < numRefined_; ++v) {
+        ring.clear();
+        Cvec3 faceNormalSum(0);
+        const Mesh::VertexIterator it0 = refined.getVertex(v).getIterator();
+        Mesh::VertexIterator it = it0;
+        do {
+            ring.push_back(it.getVertex().getIndex());
+            faceNormalSum += it.getFace().getNormal();
+            ++it;
+        } while (it != it0);
+
+        float* t1 = &weights[(size_t(v) * ROWS_PER_VERTEX + TANGENT1_ROW) * n];
+        float* t2 = &weights[(size_t(v) * ROWS_PER_VERTEX + TANGENT2_ROW) * n];
+        Cvec3 restT1(0), restT2(0);
+        const int valence = ring.size();
+        for (int k = 0; k < valence; ++k) {
+            const double c = cos(2 * CS175_PI * k / valence), s = sin(2 * CS175_PI * k / valence);
+            const float* p = &weights[(size_t(ring[k]) * ROWS_PER_VERTEX + POSITION_ROW) * n];
+            for (int j = 0; j < n; ++j) {
+                t1[j] += float(c * p[j]);
+                t2[j] += float(s * p[j]);
+            }
+            restT1 += refined.getVertex(ring[k]).getPosition() * c;
+            restT2 += refined.getVertex(ring[k]).getPosition() * s;
+        }
+
+        // The ring orientation depends on the half edge data; flip t2 so that
+        // cross(t1, t2) agrees with the averaged face normal
+        if (dot(cross(restT1, restT2), faceNormalSum) < 0) {
+            for (int j = 0; j < n; ++j)
+                t2[j] = -t2[j];
+        }
+    }
+    stencils_->upload(&weights[0], int(weights.size() * sizeof(float)));
+
+    // Triangle soup with the same fan triangulation as the CPU path
+    vector<VertexStencil> vertices;
+    for (int f = 0, nf = refined.getNumFaces(); f < nf; ++f) {
+        const Mesh::Face face = refined.getFace(f);
+        const int c0 = face.getVertex(0).getIndex(),
+                c1 = face.getVertex(1).getIndex(),
+                c2 = face.getVertex(2).getIndex();
+        for (int k = 1; k < face.getNumVertices() - 1; ++k) {
+            vertices.push_back(VertexStencil(c0, c0, c1, c2));
+            vertices.push_back(VertexStencil(face.getVertex(k).getIndex(), c0, c1, c2));
+            vertices.push_back(VertexStencil(face.getVertex(k + 1).getIndex(), c0, c1, c2));
+        }
+    }
+    vbo_->upload(&vertices[0], vertices.size());
+
+    wire(vbo_);
+    primitiveType(GL_TRIANGLES);
+
+    uniforms_.put("uStencils", shared_ptr<Texture>(stencils_));
+    uniforms_.put("uCageSize", cageSize_);
+    setSmoothShading(false);
+
+    vector<Cvec3> restCage(cageSize_);
+    for (int j = 0; j < cageSize_; ++j)
+        restCage[j] = cage.getVertex(j).getPosition();
+    setCage(&restCage[0], cageSize_);
+}
+
+bool SubdivStencilGeometry::isSupported() {
+    return GLEW_VERSION_3_1 && (!g_Gl2Compatible || GLEW_EXT_gpu_shader4);
+}
+
+void SubdivStencilGeometry::setCage(const Cvec3* positions, int numVertices) {
+    assert(numVertices == cageSize_);
+
+    // uCage is declared with MAX_CAGE_SIZE entries, so always supply all of them
+    Cvec3f cage[MAX_CAGE_SIZE];
+    for (int j = 0; j < numVertices; ++j)
+        cage[j] = Cvec3f(positions[j][0], positions[j][1], positions[j][2]);
+    uniforms_.put("uCage", cage, MAX_CAGE_SIZE);
+
+    // the refined surface lies in the convex hull of the cage
+    bounds(Bounds::fromPoints(positions, numVertices));
+}
+
+void SubdivStencilGeometry::setSmoothShading(bool smooth) {
+    uniforms_.put("uSmoothShading", smooth ? 1 : 0);
+}
@@ -0,0 +1,88 @@
+#ifndef STENCILGEOMETRY_H
+#define STENCILGEOMETRY_H
+
+#include <vector>
+#include <memory>
+
+#include "cvec.h"
+#include "mesh.h"
+#include "texture.h"
+#include "uniforms.h"
+#include "geometry.h"
+
+// Vertex of a SubdivStencilGeometry. It carries no position: `index' is the refined
+// vertex to evaluate and `corners' holds the first three refined vertices of the face
+// the vertex belongs to, used to compute flat normals. Indices are stored as floats
+// (exact up to 2^24) so they go through the usual glVertexAttribPointer path.
+struct VertexStencil {
+    float index;
+    Cvec3f corners;
+
+    static const VertexFormat FORMAT;
+
+    VertexStencil() {}
+
+    VertexStencil(int _index, int c0, int c1, int c2)
+            : index(float(_index)), corners(float(c0), float(c1), float(c2)) {}
+};
+
+// A Catmull-Clark subdivision surface evaluated on the GPU.
+//
+// Since subdivision combines positions linearly, every refined position (and the
+// two tangents used for smooth normals) is a fixed weighted sum of the control cage
+// positions. Those weights are precomputed once per topology and subdivision level
+// into a buffer texture. Per frame only the cage itself is uploaded, as a uniform
+// array, and the vertex shader (shaders/stencil-gl3.vshader) does the refinement.
+//
+// The geometry provides the uniforms uStencils, uCageSize, uCage and uSmoothShading,
+// so any material built on the stencil vertex shader can draw it.
+class SubdivStencilGeometry : public BufferObjectGeometry {
+public:
+    // Size of the uCage uniform array in the stencil vertex shader
+    static const int MAX_CAGE_SIZE = 64;
+
+    // Precompute the stencils of `levels' subdivision steps applied to `cage'. The
+    // current cage positions are only used to orient the smooth normals outward.
+    // Throws runtime_error if the cage has more than MAX_CAGE_SIZE vertices, if the
+    // context is not isSupported(), or if the stencil table has more texels than
+    // GL_MAX_TEXTURE_BUFFER_SIZE, which may be as low as 65536; callers are expected
+    // to fall back to refining on the CPU then.
+    SubdivStencilGeometry(Mesh cage, int levels);
+
+    // Whether the context can run the stencil vertex shader at all. It reads the
+    // stencils from a buffer texture, set up with glTexBuffer (core since OpenGL
+    // 3.1), and its GLSL 1.0 version needs GL_EXT_gpu_shader4 for texelFetch.
+    static bool isSupported();
+
+    // Set the control positions to be refined. `numVertices' must match the cage
+    void setCage(const Cvec3* positions, int numVertices);
+
+    void setSmoothShading(bool smooth);
+
+    int getCageSize() const {
+        return cageSize_;
+    }
+
+    int getLevels() const {
+        return levels_;
+    }
+
+    // Number of refined vertices evaluated per frame
+    int getNumRefinedVertices() const {
+        return numRefined_;
+    }
+
+    virtual const Uniforms* getUniforms() const {
+        return &uniforms_;
+    }
+
+private:
+    int cageSize_, levels_, numRefined_;
+
+    std::shared_ptr<FormattedVbo> vbo_;
+    std::shared_ptr<BufferTexture> stencils_;
+
+    Uniforms uniforms_;
+};
+
+#endif
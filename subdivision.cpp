@@ -0,0 +1,78 @@
+#include <vector>
+
+#include "subdivision.h"
+
+void asd::subdivide(Mesh& mesh) {
+
+    // add face-vertices
+    for (int fi = 0; fi < mesh.getNumFaces(); fi++) {
+        auto&& face = mesh.getFace(fi);
+
+        auto accum = Cvec3{};
+        for (int fvi = 0; fvi < face.getNumVertices(); fvi++) {
+            accum += face.getVertex(fvi).getPosition();
+        }
+        accum /= face.getNumVertices();
+        mesh.setNewFaceVertex(face, accum);
+    }
+
+    // add edge-vertices
+    for (int ei = 0; ei < mesh.getNumEdges(); ei++) {
+        auto&& edge = mesh.getEdge(ei);
+        auto const& v1 = edge.getVertex(0).getPosition();
+        auto const& v2 = edge.getVertex(1).getPosition();
+        auto const& vf1 = mesh.getNewFaceVertex(edge.getFace(0));
+        auto const& vf2 = mesh.getNewFaceVertex(edge.getFace(1));
+        auto edge_vertex_pos = Cvec3{(v1 + v2 + vf1 + vf2)} / 4;
+        mesh.setNewEdgeVertex(edge, edge_vertex_pos);
+    }
+
+    // add vertice-vertices
+    for (int vi = 0; vi < mesh.getNumVertices(); vi++) {
+        auto&& vertex = mesh.getVertex(vi);
+        auto it = vertex.getIterator();
+        auto it0 = it;
+        auto nv = 0;
+        auto face_vertex_sum = Cvec3{};
+        auto adjacent_vertex_sum = Cvec3{};
+        do {
+            ++nv;
+            face_vertex_sum += mesh.getNewFaceVertex(it.getFace());
+            adjacent_vertex_sum += it.getVertex().getPosition();
+            ++it;
+        } while (it != it0);
+
+        auto new_v_pos = Cvec3{
+                vertex.getPosition() * (static_cast<double>(nv - 2) / nv) + adjacent_vertex_sum / (nv * nv) +
+                face_vertex_sum / (nv * nv)};
+
+        mesh.setNewVertexVertex(vertex, new_v_pos);
+    }
+
+    mesh.subdivide();
+}
+
+void asd::set_averaged_normals(Mesh& mesh) {
+    auto v_num = mesh.getNumVertices();
+
+    for (int i = 0; i < v_num; i++) {
+        mesh.getVertex(i).setNormal(Cvec3{0, 0, 0});
+    }
+
+    auto face_num = mesh.getNumFaces();
+    auto vector_adjacent_faces_cnt = std::vector(v_num, 0);
+    for (int fi = 0; fi < face_num; fi++) {
+        const auto& face = mesh.getFace(fi);
+        const auto& face_normal = face.getNormal();
+        for (int vi = 0; vi < face.getNumVertices(); vi++) {
+            auto&& v = face.getVertex(vi);
+            v.setNormal(v.getNormal() + face_normal);
+            vector_adjacent_faces_cnt.at(v.getIndex())++;
+        }
+    }
+
+    for (int i = 0; i < v_num; i++) {
+        auto&& v = mesh.getVertex(i);
+        v.setNormal(v.getNormal() / vector_adjacent_faces_cnt.at(i));
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef SUBDIVISION_H
+#define SUBDIVISION_H
+
+#include <stdexcept>
+
+#include "mesh.h"
+
+namespace asd {
+    // Apply one step of Catmull-Clark subdivision to the mesh. Positions are
+    // combined linearly, so the refined positions are a fixed linear function
+    // of the control positions for a given topology.
+    void subdivide(Mesh& mesh);
+
+    // Set every vertex normal to the average of its adjacent face normals
+    void set_averaged_normals(Mesh& mesh);
+}
+
+#endif
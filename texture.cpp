@@ -29,3 +29,16 @@ ImageTexture::ImageTexture(const char* ppmFileName, bool srgb) {
 
     checkGlErrors();
 }
+
+void BufferTexture::upload(const void* data, int size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STATIC_DRAW);
+
+    glBindTexture(GL_TEXTURE_BUFFER, tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat_, buffer);
+
+    // uploaded every frame by LightManager
+#ifndef NDEBUG
+    checkGlErrors();
+#endif
+}
@@ -6,7 +6,8 @@
 class Texture {
 public:
     // Must return one of GL_SAMPLER_1D, GL_SAMPLER_2D, GL_SAMPLER_3D, GL_SAMPLER_CUBE,
-    // GL_SAMPLER_1D_SHADOW, or GL_SAMPLER_2D_SHADOW, as its intended usage by GLSL shader
+    // GL_SAMPLER_1D_SHADOW, GL_SAMPLER_2D_SHADOW, or GL_SAMPLER_BUFFER, as its intended
+    // usage by GLSL shader
     virtual GLenum getSamplerType() const = 0;
 
     // Binds the texture. (The caller is responsible for setting the active texture unit)
@@ -37,5 +38,29 @@ public:
     }
 };
 
+// A texture whose texels live in a buffer object. GLSL reads it as a samplerBuffer
+// through texelFetch, which makes it suitable for large read-only tables consumed
+// by vertex shaders.
+class BufferTexture : public Texture {
+    GlTexture tex;
+    GlBufferObject buffer;
+    GLenum internalFormat_;
+
+public:
+    // `internalFormat' is the format of a single texel, e.g., GL_R32F or GL_RGBA32F
+    BufferTexture(GLenum internalFormat = GL_R32F) : internalFormat_(internalFormat) {}
+
+    // Upload `size' bytes to the buffer backing this texture
+    void upload(const void* data, int size); // implemented in texture.cpp
+
+    virtual GLenum getSamplerType() const {
+        return GL_SAMPLER_BUFFER;
+    }
+
+    virtual void bind() const {
+        glBindTexture(GL_TEXTURE_BUFFER, tex);
+    }
+};
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include <utility>
+
+#include "transformstore.h"
+
+using namespace std;
+
+TransformStore::TransformStore(const vector<SgRbtNode*>& nodes)
+        : nodes_(nodes), back_(&frames_[0]), published_(&frames_[1]), publishedIsFresh_(false) {
+    for (int i = 0, n = nodes_.size(); i < n; ++i) {
+        slots_[nodes_[i]] = i;
+        handles_.push_back(getNodePool<SgRbtNode>().getHandle(nodes_[i]));
+    }
+
+    for (int k = 0; k < 2; ++k) {
+        frames_[k].rbts.resize(nodes_.size());
+        frames_[k].isChanged.assign(nodes_.size(), 0);
+        for (int i = 0, n = nodes_.size(); i < n; ++i)
+            frames_[k].rbts[i] = nodes_[i]->getRbt();
+    }
+}
+
+int TransformStore::getSlot(const SgRbtNode* node) const {
+    map<const SgRbtNode*, int>::const_iterator i = slots_.find(node);
+    return i == slots_.end() ? -1 : i->second;
+}
+
+void TransformStore::markChanged(Frame& frame, int slot) {
+    if (!frame.isChanged[slot]) {
+        frame.isChanged[slot] = 1;
+        frame.changed.push_back(slot);
+    }
+}
+
+void TransformStore::set(int slot, const RigTForm& rbt) {
+    back_->rbts[slot] = rbt;
+    markChanged(*back_, slot);
+}
+
+void TransformStore::publish() {
+    {
+        lock_guard<mutex> lock(mutex_);
+
+        // the render side has not applied the previous frame yet; its changes must
+        // be carried over, the values in back_ are newer anyway
+        if (publishedIsFresh_) {
+            for (size_t i = 0; i < published_->changed.size(); ++i)
+                markChanged(*back_, published_->changed[i]);
+        }
+        swap(back_, published_);
+        publishedIsFresh_ = true;
+    }
+
+    // The new back buffer is the frame published before this one. Bring it up to
+    // date with the slots written since, which are exactly the ones just published.
+    // published_ is only read by apply(), so this needs no lock.
+    for (size_t i = 0; i < back_->changed.size(); ++i)
+        back_->isChanged[back_->changed[i]] = 0;
+    back_->changed.clear();
+    for (size_t i = 0; i < published_->changed.size(); ++i) {
+        const int slot = published_->changed[i];
+        back_->rbts[slot] = published_->rbts[slot];
+    }
+}
+
+bool TransformStore::apply() {
+    lock_guard<mutex> lock(mutex_);
+    if (!publishedIsFresh_)
+        return false;
+
+    for (size_t i = 0; i < published_->changed.size(); ++i) {
+        const int slot = published_->changed[i];
+        // a dead node's address may already hold a new node
+        if (handles_[slot] != PoolHandle<SgRbtNode>() && getNodePool<SgRbtNode>().get(handles_[slot]) == NULL)
+            continue;
+        nodes_[slot]->setRbt(published_->rbts[slot]);
+    }
+    publishedIsFresh_ = false;
+    return true;
+}
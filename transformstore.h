@@ -0,0 +1,78 @@
+#ifndef TRANSFORMSTORE_H
+#define TRANSFORMSTORE_H
+
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "rigtform.h"
+#include "glsupport.h" // for Noncopyable
+#include "scenegraph.h"
+#include "nodepool.h"
+
+// Double buffered rbts for a fixed set of SgRbtNodes, so that a simulation can
+// run on its own thread without locking the scene graph.
+//
+// The simulation side (one thread) reads and writes rbts through get() and set()
+// on its back buffer, and ends each frame with publish(), which swaps the back
+// buffer with the published one. The render side calls apply() at the start of
+// a frame, which copies the latest published rbts into the nodes. The scene
+// graph itself is then only ever touched by the render thread and always holds a
+// complete simulation frame.
+//
+// Both the swap and the apply only touch the slots written during the frame.
+class TransformStore : Noncopyable {
+public:
+    // One slot per node, in order, initialized from the nodes' current rbts. Nodes
+    // of the SgRbtNode pool may die before the store, their slots are then no
+    // longer applied; other nodes must outlive it.
+    explicit TransformStore(const std::vector<SgRbtNode*>& nodes);
+
+    int getNumSlots() const {
+        return nodes_.size();
+    }
+
+    // Slot of a node, -1 if it is not in the store
+    int getSlot(const SgRbtNode* node) const;
+
+    // -- Simulation side
+
+    // Latest rbt of a slot, including writes not published yet
+    const RigTForm& get(int slot) const {
+        return back_->rbts[slot];
+    }
+
+    void set(int slot, const RigTForm& rbt);
+
+    // End the simulation frame, making the writes since the last publish() visible
+    // to apply()
+    void publish();
+
+    // -- Render side
+
+    // If a frame was published since the last call, set the nodes' rbts from it and
+    // return true
+    bool apply();
+
+private:
+    struct Frame {
+        std::vector<RigTForm> rbts;
+        std::vector<int> changed;       // slots written in this frame
+        std::vector<char> isChanged;
+    };
+
+    void markChanged(Frame& frame, int slot);
+
+    std::vector<SgRbtNode*> nodes_;
+    std::vector<PoolHandle<SgRbtNode>> handles_;   // null for nodes outside the pool
+    std::map<const SgRbtNode*, int> slots_;
+
+    // back_ belongs to the simulation side, published_ is read by apply() and only
+    // swapped under mutex_
+    Frame frames_[2];
+    Frame* back_, * published_;
+    bool publishedIsFresh_;
+    std::mutex mutex_;
+};
+
+#endif
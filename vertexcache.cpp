@@ -0,0 +1,169 @@
+#include <cmath>
+#include <algorithm>
+
+#include "vertexcache.h"
+
+using namespace std;
+
+double computeAcmr(const vector<int>& indices, int numVertices, int cacheSize) {
+    if (indices.empty())
+        return 0;
+
+    // FIFO cache: a vertex is a hit if it entered the cache less than cacheSize misses ago
+    vector<int> enteredAt(numVertices, -cacheSize - 1);
+    int misses = 0;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const int v = indices[i];
+        if (misses - enteredAt[v] > cacheSize) {
+            enteredAt[v] = misses;
+            ++misses;
+        }
+    }
+    return double(misses) / (indices.size() / 3);
+}
+
+// Parameters of the scoring function, as in Forsyth's paper
+static const int CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+// Score of a vertex from its position in the LRU cache (-1 if not cached) and its
+// number of triangles that are not emitted yet
+static float vertexScore(int cachePosition, int remainingTriangles) {
+    if (remainingTriangles == 0)
+        return -1;
+
+    float score = 0;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // the vertices of the last triangle get a fixed score, so that the next
+            // triangle does not simply continue the strip in one direction
+            score = LAST_TRIANGLE_SCORE;
+        }
+        else {
+            const float scaler = 1.f / (CACHE_SIZE - 3);
+            score = pow(1 - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+        }
+    }
+    // favour vertices with few triangles left, so that they do not end up alone
+    return score + VALENCE_BOOST_SCALE * pow(float(remainingTriangles), -VALENCE_BOOST_POWER);
+}
+
+void optimizeTriangleOrder(vector<int>& indices, int numVertices) {
+    const int numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    // Triangles of each vertex, packed in one array; the first remaining[v]
+    // entries of a vertex's range are the triangles that are not emitted yet
+    vector<int> remaining(numVertices, 0), first(numVertices + 1, 0);
+    for (int i = 0; i < numTriangles * 3; ++i)
+        ++remaining[indices[i]];
+    for (int v = 0; v < numVertices; ++v)
+        first[v + 1] = first[v] + remaining[v];
+    vector<int> triangles(first[numVertices]), filled(numVertices, 0);
+    for (int t = 0; t < numTriangles; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            const int v = indices[t * 3 + k];
+            triangles[first[v] + filled[v]++] = t;
+        }
+    }
+
+    vector<float> score(numVertices), triangleScore(numTriangles, 0);
+    for (int v = 0; v < numVertices; ++v)
+        score[v] = vertexScore(-1, remaining[v]);
+    for (int t = 0; t < numTriangles; ++t) {
+        for (int k = 0; k < 3; ++k)
+            triangleScore[t] += score[indices[t * 3 + k]];
+    }
+
+    vector<bool> emitted(numTriangles, false);
+    vector<int> output;
+    output.reserve(numTriangles * 3);
+
+    // LRU cache, most recent first. It can temporarily hold three extra vertices
+    // before the ones pushed out are dropped.
+    vector<int> cache, newCache;
+    cache.reserve(CACHE_SIZE + 3);
+    newCache.reserve(CACHE_SIZE + 3);
+
+    int best = -1, cursor = 0;
+    for (int n = 0; n < numTriangles; ++n) {
+        if (best < 0) {
+            // nothing in the cache is connected to a remaining triangle, start over
+            // from the first triangle that is left
+            while (emitted[cursor])
+                ++cursor;
+            best = cursor;
+        }
+
+        emitted[best] = true;
+        newCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            const int v = indices[best * 3 + k];
+            output.push_back(v);
+            newCache.push_back(v);
+
+            // remove the triangle from the vertex's remaining ones
+            int* tris = &triangles[first[v]];
+            const int count = remaining[v]--;
+            for (int j = 0; j < count; ++j) {
+                if (tris[j] == best) {
+                    swap(tris[j], tris[count - 1]);
+                    break;
+                }
+            }
+        }
+        for (size_t i = 0; i < cache.size(); ++i) {
+            const int v = cache[i];
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache.push_back(v);
+        }
+        cache.swap(newCache);
+
+        // Rescore every vertex whose cache position may have changed, including the
+        // ones that just fell out of the cache, and their remaining triangles
+        for (size_t i = 0; i < cache.size(); ++i) {
+            const int v = cache[i];
+            const int position = int(i) < CACHE_SIZE ? int(i) : -1;
+            const float newScore = vertexScore(position, remaining[v]);
+            const float delta = newScore - score[v];
+            score[v] = newScore;
+            for (int j = 0; j < remaining[v]; ++j)
+                triangleScore[triangles[first[v] + j]] += delta;
+        }
+        if (int(cache.size()) > CACHE_SIZE)
+            cache.resize(CACHE_SIZE);
+
+        // The next triangle is the best one touching the cache
+        best = -1;
+        float bestScore = -1;
+        for (size_t i = 0; i < cache.size(); ++i) {
+            const int v = cache[i];
+            for (int j = 0; j < remaining[v]; ++j) {
+                const int t = triangles[first[v] + j];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+    indices.swap(output);
+}
+
+vector<int> computeFetchRemap(const vector<int>& indices, int numVertices) {
+    vector<int> remap(numVertices, -1);
+    int next = 0;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        if (remap[indices[i]] < 0)
+            remap[indices[i]] = next++;
+    }
+    for (int v = 0; v < numVertices; ++v) {
+        if (remap[v] < 0)
+            remap[v] = next++;
+    }
+    return remap;
+}
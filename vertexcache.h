@@ -0,0 +1,57 @@
+#ifndef VERTEXCACHE_H
+#define VERTEXCACHE_H
+
+#include <vector>
+#include <cassert>
+
+// Reordering of indexed triangle lists (GL_TRIANGLES) for the GPU:
+//  - triangles are reordered so that consecutive triangles share vertices that
+//    are still in the post-transform vertex cache (Tom Forsyth's linear speed
+//    vertex cache optimization)
+//  - vertices are then renumbered in the order they are first used, so vertex
+//    fetches walk through the vertex buffer sequentially
+//
+// The quality measure is the ACMR (average cache miss ratio), the number of
+// vertices transformed per triangle for a FIFO cache of a given size: 3 for no
+// reuse at all, around 0.5 - 0.7 for a well ordered regular mesh.
+
+struct VertexCacheStats {
+    double acmrBefore, acmrAfter;
+};
+
+// ACMR of a triangle list for a FIFO cache holding `cacheSize' vertices
+double computeAcmr(const std::vector<int>& indices, int numVertices, int cacheSize = 16);
+
+// Reorders the triangles of `indices' in place
+void optimizeTriangleOrder(std::vector<int>& indices, int numVertices);
+
+// Returns, for each vertex, its position in the order of first use by `indices'.
+// Vertices that are not referenced go last, in their original order.
+std::vector<int> computeFetchRemap(const std::vector<int>& indices, int numVertices);
+
+// Runs both passes on a vertex and index array pair, to be called before they are
+// uploaded (e.g. with SimpleIndexedGeometry::upload). The vertices are permuted and
+// the indices rewritten accordingly; the rendered triangles are the same.
+template<typename Vertex, typename Index>
+VertexCacheStats optimizeVertexCache(std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+    assert(indices.size() % 3 == 0);
+    const int numVertices = vertices.size();
+    std::vector<int> order(indices.begin(), indices.end());
+
+    VertexCacheStats stats;
+    stats.acmrBefore = computeAcmr(order, numVertices);
+    optimizeTriangleOrder(order, numVertices);
+
+    const std::vector<int> remap = computeFetchRemap(order, numVertices);
+    std::vector<Vertex> remapped(vertices);
+    for (int i = 0; i < numVertices; ++i)
+        remapped[remap[i]] = vertices[i];
+    vertices.swap(remapped);
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = Index(remap[order[i]]);
+
+    stats.acmrAfter = computeAcmr(std::vector<int>(indices.begin(), indices.end()), numVertices);
+    return stats;
+}
+
+#endif
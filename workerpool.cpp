@@ -0,0 +1,91 @@
+#include <algorithm>
+
+#include "workerpool.h"
+
+using namespace std;
+
+WorkerPool::WorkerPool(int numThreads)
+        : generation_(0), busyThreads_(0), stopRequested_(false), task_(NULL), numTasks_(0), nextTask_(0) {
+    if (numThreads < 0)
+        numThreads = max(int(thread::hardware_concurrency()) - 1, 0);
+    for (int i = 0; i < numThreads; ++i)
+        threads_.push_back(thread(&WorkerPool::threadMain, this));
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopRequested_ = true;
+    }
+    runPosted_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+        threads_[i].join();
+}
+
+void WorkerPool::run(int numTasks, const Task& task) {
+    if (numTasks <= 0)
+        return;
+
+    // not worth waking anybody up for
+    if (numTasks == 1 || threads_.empty()) {
+        for (int i = 0; i < numTasks; ++i)
+            task(i);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        task_ = &task;
+        numTasks_ = numTasks;
+        nextTask_ = 0;
+        exception_ = nullptr;
+        busyThreads_ = threads_.size();
+        ++generation_;
+    }
+    runPosted_.notify_all();
+
+    work();
+
+    unique_lock<mutex> lock(mutex_);
+    runDone_.wait(lock, [this] { return busyThreads_ == 0; });
+    task_ = NULL;
+    if (exception_) {
+        exception_ptr e = exception_;
+        exception_ = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+void WorkerPool::work() {
+    for (int i = nextTask_++; i < numTasks_; i = nextTask_++) {
+        try {
+            (*task_)(i);
+        }
+        catch (...) {
+            lock_guard<mutex> lock(mutex_);
+            if (!exception_)
+                exception_ = current_exception();
+        }
+    }
+}
+
+void WorkerPool::threadMain() {
+    unsigned long seenGeneration = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(mutex_);
+            runPosted_.wait(lock, [&] { return stopRequested_ || generation_ != seenGeneration; });
+            if (stopRequested_)
+                return;
+            seenGeneration = generation_;
+        }
+
+        work();
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            --busyThreads_;
+        }
+        runDone_.notify_one();
+    }
+}
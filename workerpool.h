@@ -0,0 +1,60 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+#include "glsupport.h" // for Noncopyable
+
+// A fixed set of threads for running the iterations of a parallel loop, such as
+// the per frame scene preparation in FlatScene. The threads sleep between loops,
+// so they are cheap to keep around.
+//
+// run() hands out task indices to the pool threads and to the calling thread
+// alike, and returns once every task is done. The tasks must not touch GL.
+class WorkerPool : Noncopyable {
+public:
+    typedef std::function<void(int task)> Task;
+
+    // Starts `numThreads' threads besides the caller, or one less than the number
+    // of hardware threads if negative
+    explicit WorkerPool(int numThreads = -1);
+
+    // Stops and joins the threads
+    ~WorkerPool();
+
+    // Number of threads that work on a run(), including the caller
+    int getNumWorkers() const {
+        return threads_.size() + 1;
+    }
+
+    // Call task(i) for i in [0, numTasks), in parallel and in no particular order.
+    // If tasks throw, the first exception is rethrown once all tasks have ended.
+    void run(int numTasks, const Task& task);
+
+private:
+    void threadMain();
+
+    // Take tasks of the current run until there are none left
+    void work();
+
+    std::mutex mutex_;
+    std::condition_variable runPosted_, runDone_;
+    unsigned long generation_;  // incremented for every run()
+    int busyThreads_;
+    bool stopRequested_;
+
+    const Task* task_;
+    int numTasks_;
+    std::atomic<int> nextTask_;
+    std::exception_ptr exception_;
+
+    std::vector<std::thread> threads_;
+};
+
+#endif